@@ -2,17 +2,66 @@
 // Fast JSON encoder/decoder implementation for Python
 //
 
+#define PY_SSIZE_T_CLEAN
 #include <Python.h>
+#include <pythread.h>
 #include <stddef.h>
 #include <stdio.h>
-#include <ctype.h>
 #include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+typedef struct ObjectStack {
+    PyObject **items; // the objects on the stack
+    Py_ssize_t size; // number of objects on the stack
+    Py_ssize_t allocated; // number of slots allocated in items
+} ObjectStack;
+
+typedef struct Container {
+    int type; // '[' for arrays and '{' for objects
+    int state; // the next element expected inside the container
+    Py_ssize_t start; // position of the opening bracket or brace
+    Py_ssize_t base; // object stack size when the container was opened
+    PyObject *fields; // the selected members (see compile_fields), NULL for all
+    PyObject *member_fields; // the selection for the current member value
+} Container;
+
+typedef struct ContainerStack {
+    Container *items; // the containers being parsed, innermost last
+    Py_ssize_t size; // current nesting depth
+    Py_ssize_t allocated; // number of slots allocated in items
+} ContainerStack;
+
+typedef struct StringScan {
+    Py_ssize_t length; // how much of an incomplete string was already scanned
+    int escaping, has_unicode, string_escape; // the scanner state at that point
+} StringScan;
 
 typedef struct JSONData {
     char *str; // the actual json string
     char *end; // pointer to the string end
     char *ptr; // pointer to the current parsing position
+    Py_ssize_t offset; // position of str in the JSON input (for error reporting)
+    PyObject *owner; // the object holding the whole input, NULL for streams
     int  all_unicode; // make all output strings unicode if true
+    int  partial; // more input may follow after end
+    int  incomplete; // set when decoding stopped because more input is needed
+    int  events; // return parsing events one by one instead of the decoded value
+    StringScan string_scan; // saved state when a string was left incomplete
+    Py_ssize_t max_depth; // maximum nesting depth of arrays and objects
+    PyObject *fields; // the selected parts of the value, NULL to decode all
+    PyObject *object_hook; // called with every decoded object (can be NULL)
+    PyObject *object_pairs_hook; // called with the members of every object (can be NULL)
+    int  tuple_arrays; // decode arrays as tuples instead of lists
+    PyObject *decimal_type; // build floating point numbers as decimals (can be NULL)
+    int  raw_numbers; // decode numbers as RawNumber objects
+    int  numeric_arrays; // decode arrays of numbers as array.array
+    char *counted; // the input up to which lines were counted for errors on
+                   // inputs that are not strings
+    char *line_start; // the start of the line that contains counted
+    Py_ssize_t lineno; // the number of the line that contains counted
+    ObjectStack stack; // decoded items of the containers being parsed
+    ContainerStack containers; // arrays and objects being parsed
 } JSONData;
 
 static PyObject* encode_object(PyObject *object);
@@ -26,16 +75,57 @@ static PyObject* decode_json(JSONData *jsondata);
 static PyObject* decode_null(JSONData *jsondata);
 static PyObject* decode_bool(JSONData *jsondata);
 static PyObject* decode_string(JSONData *jsondata);
+static int scan_skip_value(JSONData *jsondata);
 static PyObject* decode_inf(JSONData *jsondata);
 static PyObject* decode_nan(JSONData *jsondata);
 static PyObject* decode_number(JSONData *jsondata);
-static PyObject* decode_array(JSONData *jsondata);
-static PyObject* decode_object(JSONData *jsondata);
+
+static PyObject* make_raw_number(PyObject *text);
+static PyTypeObject RawNumber_Type;
+static PyTypeObject RawJSON_Type;
+
+typedef enum {
+    StartMapEvent=0,
+    MapKeyEvent,
+    EndMapEvent,
+    StartArrayEvent,
+    EndArrayEvent,
+    StringEvent,
+    NumberEvent,
+    BooleanEvent,
+    NullEvent,
+    EventCount
+} JSONEvent;
+
+static PyObject *event_names[EventCount];
+
+typedef enum {
+    NoError=0,
+    EmptyDescription,
+    CannotParse,
+    InvalidNumber,
+    InvalidString,
+    UnterminatedString,
+    UnterminatedArray,
+    UnterminatedObject,
+    ExpectingArrayItem,
+    ExpectingArrayComma,
+    ExpectingPropertyName,
+    MissingColon,
+    ExpectingPropertyValue,
+    ExpectingObjectComma,
+    MaxDepthExceeded,
+    ExtraData,
+    OutOfMemory
+} ScanError;
 
 static PyObject *JSON_Error;
 static PyObject *JSON_EncodeError;
 static PyObject *JSON_DecodeError;
 
+static PyObject *Decimal_Type = NULL; // decimal.Decimal, imported when first needed
+static PyObject *Array_Type = NULL; // array.array, imported when first needed
+
 
 #define _string(x) #x
 #define string(x) _string(x)
@@ -61,15 +151,534 @@ typedef int Py_ssize_t;
 #define NAN (HUGE_VAL - HUGE_VAL)
 #endif
 
+#ifndef S_ISREG
+#define S_ISREG(mode) (((mode) & S_IFMT) == S_IFREG)
+#endif
+
 #ifndef Py_IS_NAN
 #define Py_IS_NAN(X) ((X) != (X))
 #endif
 
-#define skipSpaces(d) while(isspace(*((d)->ptr))) (d)->ptr++
+// default limit for the nesting depth of the decoded arrays and objects
+#define DEFAULT_MAX_DEPTH 10000
+
+// integers up to this magnitude are converted to doubles exactly
+#define MAX_EXACT_DOUBLE_INTEGER ((PY_LONG_LONG)1 << 53)
+
+// position of the pointer p in the JSON input
+#define position(d, p) ((Py_ssize_t)((p) - (d)->str) + (d)->offset)
+
+// classes of the input characters, looked up instead of calling the ctype
+// functions, which depend on the locale and accept more whitespace than JSON
+enum CharClass {
+    CharSpace = 0x01, // space, tab, newline and carriage return
+    CharDigit = 0x02,
+    CharHexDigit = 0x04
+};
+
+#define S CharSpace
+#define D (CharDigit | CharHexDigit)
+#define H CharHexDigit
+
+static const unsigned char char_class[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, S, S, 0, 0, S, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    S, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    D, D, D, D, D, D, D, D, D, D, 0, 0, 0, 0, 0, 0,
+    0, H, H, H, H, H, H, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, H, H, H, H, H, H, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+#undef S
+#undef D
+#undef H
+
+#define isSpace(c) (char_class[(unsigned char)(c)] & CharSpace)
+#define isDigitChar(c) (char_class[(unsigned char)(c)] & CharDigit)
+#define isHexDigitChar(c) (char_class[(unsigned char)(c)] & CharHexDigit)
+#define isNonASCII(c) ((unsigned char)(c) & 0x80)
+
+#define skipSpaces(d) while((d)->ptr < (d)->end && isSpace(*((d)->ptr))) (d)->ptr++
+
+
+/* --------------------------- Scratch buffers ------------------------- */
+
+/*
+ * The decoder stacks and tapes are allocated with malloc and grow as needed.
+ * When a decoder is done with them they are kept in a small cache instead of
+ * being freed, so the following decoders start with buffers that are already
+ * allocated and large enough, rather than allocating and growing new ones on
+ * every call. The cache is protected by the GIL.
+ */
+
+#define SCRATCH_CACHE_SIZE 8
+#define SCRATCH_MAX_CACHED_SIZE 1048576 // larger buffers are freed
+
+typedef struct ScratchBuffer {
+    void *data;
+    size_t size;
+} ScratchBuffer;
+
+static ScratchBuffer scratch_cache[SCRATCH_CACHE_SIZE];
+static int scratch_count = 0;
+
+
+// Take a cached buffer of at least size bytes, storing its actual size in
+// size. Returns NULL if there is none
+static void*
+scratch_get(size_t *size)
+{
+    void *data;
+    int i;
+
+    for (i = scratch_count-1; i >= 0; i--) {
+        if (scratch_cache[i].size >= *size) {
+            data = scratch_cache[i].data;
+            *size = scratch_cache[i].size;
+            scratch_cache[i] = scratch_cache[--scratch_count];
+            return data;
+        }
+    }
+    return NULL;
+}
+
+
+// Release a buffer, keeping it in the cache when there is room for it
+static void
+scratch_put(void *data, size_t size)
+{
+    if (data == NULL)
+        return;
+    if (scratch_count < SCRATCH_CACHE_SIZE && size <= SCRATCH_MAX_CACHED_SIZE) {
+        scratch_cache[scratch_count].data = data;
+        scratch_cache[scratch_count].size = size;
+        scratch_count++;
+    } else {
+        free(data);
+    }
+}
+
+
+// Grow the buffer data to hold at least *count items of item_size bytes,
+// starting from a cached buffer when data is NULL. The new capacity is stored
+// in count. Returns NULL when out of memory
+static void*
+scratch_resize(void *data, Py_ssize_t *count, size_t item_size)
+{
+    void *cached;
+    size_t size;
+
+    if (*count > PY_SSIZE_T_MAX / (Py_ssize_t)item_size)
+        return NULL;
+    size = *count * item_size;
+    if (data == NULL) {
+        cached = scratch_get(&size);
+        if (cached != NULL) {
+            *count = size / item_size;
+            return cached;
+        }
+    }
+    return realloc(data, size);
+}
+
+
+/* ---------------------------- Object stack --------------------------- */
+
+#define OBJECT_STACK_INITIAL_SIZE 64
+#define CONTAINER_STACK_INITIAL_SIZE 32
+#define INPUT_BUFFER_INITIAL_SIZE 4096
+#define STREAM_CHUNK_SIZE 65536
+
+static void
+stack_init(ObjectStack *stack)
+{
+    stack->items = NULL;
+    stack->size = 0;
+    stack->allocated = 0;
+}
+
+
+// Push a new reference on the stack. The reference is stolen, even on failure
+static int
+stack_push(ObjectStack *stack, PyObject *object)
+{
+    if (stack->size == stack->allocated) {
+        PyObject **items;
+        Py_ssize_t allocated;
+
+        allocated = stack->allocated ? stack->allocated*2 : OBJECT_STACK_INITIAL_SIZE;
+        items = scratch_resize(stack->items, &allocated, sizeof(PyObject*));
+        if (items == NULL) {
+            Py_DECREF(object);
+            PyErr_NoMemory();
+            return -1;
+        }
+        stack->items = items;
+        stack->allocated = allocated;
+    }
+    stack->items[stack->size++] = object;
+    return 0;
+}
+
+
+// Drop all the objects above the given stack size
+static void
+stack_pop_to(ObjectStack *stack, Py_ssize_t size)
+{
+    while (stack->size > size) {
+        stack->size--;
+        Py_DECREF(stack->items[stack->size]);
+    }
+}
+
+
+static void
+stack_free(ObjectStack *stack)
+{
+    stack_pop_to(stack, 0);
+    scratch_put(stack->items, stack->allocated * sizeof(PyObject*));
+    stack->items = NULL;
+    stack->allocated = 0;
+}
+
+
+static void
+containers_init(ContainerStack *containers)
+{
+    containers->items = NULL;
+    containers->size = 0;
+    containers->allocated = 0;
+}
+
+
+static void
+containers_free(ContainerStack *containers)
+{
+    scratch_put(containers->items, containers->allocated * sizeof(Container));
+    containers_init(containers);
+}
+
+
+// Initialize the decoder state. The input must be set separately
+static void
+jsondata_init(JSONData *jsondata, int all_unicode, Py_ssize_t max_depth)
+{
+    jsondata->str = jsondata->end = jsondata->ptr = NULL;
+    jsondata->offset = 0;
+    jsondata->owner = NULL;
+    jsondata->all_unicode = all_unicode;
+    jsondata->partial = False;
+    jsondata->incomplete = False;
+    jsondata->events = False;
+    jsondata->string_scan.length = 0;
+    jsondata->max_depth = max_depth;
+    jsondata->fields = NULL;
+    jsondata->object_hook = jsondata->object_pairs_hook = NULL;
+    jsondata->tuple_arrays = False;
+    jsondata->decimal_type = NULL;
+    jsondata->raw_numbers = False;
+    jsondata->numeric_arrays = False;
+    jsondata->counted = jsondata->line_start = NULL;
+    jsondata->lineno = 1;
+    stack_init(&jsondata->stack);
+    containers_init(&jsondata->containers);
+}
+
+
+static void
+jsondata_free(JSONData *jsondata)
+{
+    stack_free(&jsondata->stack);
+    containers_free(&jsondata->containers);
+}
+
+
+// Get the decimal.Decimal type, importing the decimal module on first use
+static PyObject*
+get_decimal_type(void)
+{
+    PyObject *module;
+
+    if (Decimal_Type == NULL) {
+        module = PyImport_ImportModule("decimal");
+        if (module == NULL)
+            return NULL;
+        Decimal_Type = PyObject_GetAttrString(module, "Decimal");
+        Py_DECREF(module);
+    }
+    return Decimal_Type;
+}
+
+
+// Get the array.array type, importing the array module on first use
+static PyObject*
+get_array_type(void)
+{
+    PyObject *module;
+
+    if (Array_Type == NULL) {
+        module = PyImport_ImportModule("array");
+        if (module == NULL)
+            return NULL;
+        Array_Type = PyObject_GetAttrString(module, "array");
+        Py_DECREF(module);
+    }
+    return Array_Type;
+}
+
+
+// Make an array.array of the given type code holding a copy of the size bytes
+// at data, which are machine values of that type
+static PyObject*
+make_typed_array(const char *typecode, const void *data, Py_ssize_t size)
+{
+    PyObject *array_type, *array, *bytes, *result;
+
+    array_type = get_array_type();
+    if (array_type == NULL)
+        return NULL;
+    array = PyObject_CallFunction(array_type, "s", typecode);
+    if (array == NULL)
+        return NULL;
+    bytes = PyString_FromStringAndSize(data, size);
+    if (bytes == NULL) {
+        Py_DECREF(array);
+        return NULL;
+    }
+    result = PyObject_CallMethod(array, "fromstring", "O", bytes);
+    Py_DECREF(bytes);
+    if (result == NULL) {
+        Py_DECREF(array);
+        return NULL;
+    }
+    Py_DECREF(result);
+    return array;
+}
+
+
+// Set the decoding options from the decode arguments, where None means no hook
+static int
+jsondata_set_options(JSONData *jsondata, PyObject *object_hook,
+                     PyObject *object_pairs_hook, PyObject *array_type,
+                     int use_decimal, int raw_numbers)
+{
+    if (array_type != (PyObject*)&PyList_Type && array_type != (PyObject*)&PyTuple_Type) {
+        PyErr_SetString(PyExc_ValueError, "array_type must be list or tuple");
+        return -1;
+    }
+    if (object_hook != Py_None && !PyCallable_Check(object_hook)) {
+        PyErr_SetString(PyExc_TypeError, "object_hook must be callable");
+        return -1;
+    }
+    if (object_pairs_hook != Py_None && !PyCallable_Check(object_pairs_hook)) {
+        PyErr_SetString(PyExc_TypeError, "object_pairs_hook must be callable");
+        return -1;
+    }
+    if (use_decimal && raw_numbers) {
+        PyErr_SetString(PyExc_ValueError, "use_decimal and raw_numbers cannot be used together");
+        return -1;
+    }
+    jsondata->raw_numbers = raw_numbers;
+    jsondata->object_hook = object_hook==Py_None ? NULL : object_hook;
+    jsondata->object_pairs_hook = object_pairs_hook==Py_None ? NULL : object_pairs_hook;
+    jsondata->tuple_arrays = (array_type == (PyObject*)&PyTuple_Type);
+    if (use_decimal) {
+        jsondata->decimal_type = get_decimal_type();
+        if (jsondata->decimal_type == NULL)
+            return -1;
+    }
+    return 0;
+}
 
 
 /* ------------------------------ Decoding ----------------------------- */
 
+// the input kept by a decode error on each side of its position
+#define EXCERPT_LENGTH 20
+
+// the arguments of the errors raised by raise_decode_error (see Decode errors)
+enum ErrorArgument {
+    ErrorFormat=0,
+    ErrorPosition,
+    ErrorValues,
+    ErrorDocument,
+    ErrorDocumentPosition,
+    ErrorInput,
+    ErrorLine,
+    ErrorColumn,
+    ErrorArgumentCount
+};
+
+#define error_args(e) (((PyBaseExceptionObject*)(e))->args)
+#define has_error_info(e) (PyTuple_GET_SIZE(error_args(e)) == ErrorArgumentCount && \
+                           PyString_Check(PyTuple_GET_ITEM(error_args(e), ErrorFormat)) && \
+                           PyTuple_Check(PyTuple_GET_ITEM(error_args(e), ErrorValues)))
+
+/*
+ * Convert the arguments of a PyErr_Format style format into a tuple of python
+ * objects, so the message can be formatted only when it is needed. Only the
+ * conversions used by the decode errors are supported: %c, %d, %zd and %s.
+ */
+static PyObject*
+format_values(const char *format, va_list vargs)
+{
+    PyObject *values, *value;
+    Py_ssize_t count;
+    const char *f;
+    int size_t_arg;
+
+    for (count = 0, f = format; *f; f++) {
+        if (*f == '%' && *++f != '%')
+            count++;
+    }
+    values = PyTuple_New(count);
+    if (values == NULL)
+        return NULL;
+
+    for (count = 0, f = format; *f; f++) {
+        if (*f != '%' || *++f == '%')
+            continue;
+        size_t_arg = (*f == 'z');
+        if (size_t_arg)
+            f++;
+        switch (*f) {
+        case 's':
+            value = PyString_FromString(va_arg(vargs, const char*));
+            break;
+        default: // 'c' and 'd'
+            if (size_t_arg)
+                value = PyInt_FromSsize_t(va_arg(vargs, Py_ssize_t));
+            else
+                value = PyInt_FromLong(va_arg(vargs, int));
+            break;
+        }
+        if (value == NULL) {
+            Py_DECREF(values);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(values, count++, value);
+    }
+
+    return values;
+}
+
+
+/*
+ * Raise a DecodeError for the input position pos, with the message given by
+ * format like PyErr_Format does. The exception value is left as the arguments
+ * tuple, which the interpreter only turns into an exception instance if the
+ * error is caught. The message is only formatted when it is requested and
+ * only a short excerpt of the input around the error is kept for it (see
+ * Decode errors). The line and column of the error are found when they are
+ * requested in string inputs, which the error refers to. The other inputs
+ * can change or go away, so their lines are counted here, from where the
+ * previous error of the same decoder was.
+ */
+static void
+raise_decode_error(JSONData *jsondata, Py_ssize_t pos, const char *format, ...)
+{
+    PyObject *template, *values, *excerpt, *args;
+    char *ptr, *start, *end, *newline;
+    va_list vargs;
+
+    template = PyString_FromString(format);
+    if (template == NULL)
+        return;
+    va_start(vargs, format);
+    values = format_values(format, vargs);
+    va_end(vargs);
+    if (values == NULL) {
+        Py_DECREF(template);
+        return;
+    }
+
+    ptr = jsondata->str + (pos - jsondata->offset);
+    if (jsondata->owner == NULL || ptr < jsondata->str || ptr > jsondata->end) {
+        args = Py_BuildValue("(NnNOOOOO)", template, pos, values,
+                             Py_None, Py_None, Py_None, Py_None, Py_None);
+    } else {
+        start = ptr - jsondata->str > EXCERPT_LENGTH ? ptr - EXCERPT_LENGTH : jsondata->str;
+        end = jsondata->end - ptr > EXCERPT_LENGTH ? ptr + EXCERPT_LENGTH : jsondata->end;
+        excerpt = PyString_FromStringAndSize(start, end - start);
+        if (excerpt == NULL) {
+            Py_DECREF(template);
+            Py_DECREF(values);
+            return;
+        }
+        if (PyString_Check(jsondata->owner) && jsondata->offset == 0 &&
+            jsondata->str == PyString_AS_STRING(jsondata->owner)) {
+            args = Py_BuildValue("(NnNNnOOO)", template, pos, values, excerpt,
+                                 position(jsondata, start), jsondata->owner,
+                                 Py_None, Py_None);
+        } else {
+            if (jsondata->counted == NULL || jsondata->counted < jsondata->str ||
+                jsondata->counted > ptr) {
+                jsondata->counted = jsondata->line_start = jsondata->str;
+                jsondata->lineno = 1;
+            }
+            while ((newline = memchr(jsondata->counted, '\n', ptr - jsondata->counted)) != NULL) {
+                jsondata->lineno++;
+                jsondata->counted = jsondata->line_start = newline + 1;
+            }
+            jsondata->counted = ptr;
+            args = Py_BuildValue("(NnNNnOnn)", template, pos, values, excerpt,
+                                 position(jsondata, start), Py_None, jsondata->lineno,
+                                 (Py_ssize_t)(ptr - jsondata->line_start + 1));
+        }
+    }
+    if (args == NULL)
+        return;
+    PyErr_SetObject(JSON_DecodeError, args);
+    Py_DECREF(args);
+}
+
+
+// Raise a DecodeError showing an excerpt of the input that cannot be parsed
+static void
+raise_parse_error(JSONData *jsondata)
+{
+    char excerpt[21];
+    ptrdiff_t length;
+
+    // the input is not necessarily NUL terminated
+    length = jsondata->end - jsondata->ptr;
+    if (length > 20)
+        length = 20;
+    memcpy(excerpt, jsondata->ptr, length);
+    excerpt[length] = 0;
+
+    raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                       "cannot parse JSON description: %s", excerpt);
+}
+
+
+// Check if the input ends with an incomplete literal that more input may
+// complete, in which case the decoder is flagged as needing more input.
+static int
+incomplete_literal(JSONData *jsondata, const char *literal, ptrdiff_t length)
+{
+    ptrdiff_t left;
+
+    left = jsondata->end - jsondata->ptr;
+
+    if (jsondata->partial && left < length && memcmp(jsondata->ptr, literal, left)==0) {
+        jsondata->incomplete = True;
+        return True;
+    }
+    return False;
+}
+
+
 static PyObject*
 decode_null(JSONData *jsondata)
 {
@@ -77,13 +686,14 @@ decode_null(JSONData *jsondata)
 
     left = jsondata->end - jsondata->ptr;
 
-    if (left >= 4 && strncmp(jsondata->ptr, "null", 4)==0) {
+    if (left >= 4 && memcmp(jsondata->ptr, "null", 4)==0) {
         jsondata->ptr += 4;
         Py_INCREF(Py_None);
         return Py_None;
+    } else if (incomplete_literal(jsondata, "null", 4)) {
+        return NULL;
     } else {
-        PyErr_Format(JSON_DecodeError, "cannot parse JSON description: %.20s",
-                     jsondata->ptr);
+        raise_parse_error(jsondata);
         return NULL;
     }
 }
@@ -96,47 +706,47 @@ decode_bool(JSONData *jsondata)
 
     left = jsondata->end - jsondata->ptr;
 
-    if (left >= 4 && strncmp(jsondata->ptr, "true", 4)==0) {
+    if (left >= 4 && memcmp(jsondata->ptr, "true", 4)==0) {
         jsondata->ptr += 4;
         Py_INCREF(Py_True);
         return Py_True;
-    } else if (left >= 5 && strncmp(jsondata->ptr, "false", 5)==0) {
+    } else if (left >= 5 && memcmp(jsondata->ptr, "false", 5)==0) {
         jsondata->ptr += 5;
         Py_INCREF(Py_False);
         return Py_False;
+    } else if (incomplete_literal(jsondata, "true", 4) ||
+               incomplete_literal(jsondata, "false", 5)) {
+        return NULL;
     } else {
-        PyErr_Format(JSON_DecodeError, "cannot parse JSON description: %.20s",
-                     jsondata->ptr);
+        raise_parse_error(jsondata);
         return NULL;
     }
 }
 
 
-static PyObject*
-decode_string(JSONData *jsondata)
+/*
+ * Look for the closing quote of a string, starting at ptr which is either just
+ * after the opening quote or where a previous scan stopped. The scanner state
+ * is kept in scan, which also records what kind of decoding the string needs.
+ * Returns a pointer to the closing quote or NULL if end was reached first.
+ */
+static char*
+scan_string(char *ptr, char *end, StringScan *scan)
 {
-    PyObject *object;
     int c, escaping, has_unicode, string_escape;
-    Py_ssize_t len;
-    char *ptr;
 
-    // look for the closing quote
-    escaping = has_unicode = string_escape = False;
-    ptr = jsondata->ptr + 1;
-    while (True) {
+    escaping = scan->escaping;
+    has_unicode = scan->has_unicode;
+    string_escape = scan->string_escape;
+
+    for (; ptr < end; ptr++) {
         c = *ptr;
-        if (c == 0) {
-            PyErr_Format(JSON_DecodeError,
-                         "unterminated string starting at position " SSIZE_T_F,
-                         (Py_ssize_t)(jsondata->ptr - jsondata->str));
-            return NULL;
-        }
         if (!escaping) {
             if (c == '\\') {
                 escaping = True;
             } else if (c == '"') {
                 break;
-            } else if (!isascii(c)) {
+            } else if (isNonASCII(c)) {
                 has_unicode = True;
             }
         } else {
@@ -156,14 +766,55 @@ decode_string(JSONData *jsondata)
             }
             escaping = False;
         }
-        ptr++;
+    }
+
+    scan->escaping = escaping;
+    scan->has_unicode = has_unicode;
+    scan->string_escape = string_escape;
+
+    return ptr < end ? ptr : NULL;
+}
+
+
+static PyObject*
+decode_string(JSONData *jsondata)
+{
+    PyObject *object;
+    StringScan scan;
+    Py_ssize_t len;
+    char *ptr;
+
+    // look for the closing quote
+    if (jsondata->string_scan.length > 0) {
+        // resume scanning a string that was previously left incomplete
+        scan = jsondata->string_scan;
+        ptr = jsondata->ptr + scan.length;
+        jsondata->string_scan.length = 0;
+    } else {
+        scan.escaping = scan.has_unicode = scan.string_escape = False;
+        ptr = jsondata->ptr + 1;
+    }
+
+    ptr = scan_string(ptr, jsondata->end, &scan);
+    if (ptr == NULL) {
+        if (jsondata->partial) {
+            // save the scanner state to continue when more input arrives
+            scan.length = jsondata->end - jsondata->ptr;
+            jsondata->string_scan = scan;
+            jsondata->incomplete = True;
+            return NULL;
+        }
+        raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                           "unterminated string starting at position " SSIZE_T_F,
+                           position(jsondata, jsondata->ptr));
+        return NULL;
     }
 
     len = ptr - jsondata->ptr - 1;
 
-    if (has_unicode || jsondata->all_unicode)
+    if (scan.has_unicode || jsondata->all_unicode)
         object = PyUnicode_DecodeUnicodeEscape(jsondata->ptr+1, len, NULL);
-    else if (string_escape)
+    else if (scan.string_escape)
         object = PyString_DecodeEscape(jsondata->ptr+1, len, NULL, 0, NULL);
     else
         object = PyString_FromStringAndSize(jsondata->ptr+1, len);
@@ -173,21 +824,23 @@ decode_string(JSONData *jsondata)
 
         PyErr_Fetch(&type, &value, &tb);
         if (type == NULL) {
-            PyErr_Format(JSON_DecodeError,
-                         "invalid string starting at position " SSIZE_T_F,
-                         (Py_ssize_t)(jsondata->ptr - jsondata->str));
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "invalid string starting at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
         } else {
             if (PyErr_GivenExceptionMatches(type, PyExc_UnicodeDecodeError)) {
                 reason = PyObject_GetAttrString(value, "reason");
-                PyErr_Format(JSON_DecodeError, "cannot decode string starting"
-                             " at position " SSIZE_T_F ": %s",
-                             (Py_ssize_t)(jsondata->ptr - jsondata->str),
-                             reason ? PyString_AsString(reason) : "bad format");
+                raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                                   "cannot decode string starting"
+                                   " at position " SSIZE_T_F ": %s",
+                                   position(jsondata, jsondata->ptr),
+                                   reason ? PyString_AsString(reason)
+                                          : "bad format");
                 Py_XDECREF(reason);
             } else {
-                PyErr_Format(JSON_DecodeError,
-                             "invalid string starting at position " SSIZE_T_F,
-                             (Py_ssize_t)(jsondata->ptr - jsondata->str));
+                raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                                   "invalid string starting at position " SSIZE_T_F,
+                                   position(jsondata, jsondata->ptr));
             }
         }
         Py_XDECREF(type);
@@ -209,21 +862,24 @@ decode_inf(JSONData *jsondata)
 
     left = jsondata->end - jsondata->ptr;
 
-    if (left >= 8 && strncmp(jsondata->ptr, "Infinity", 8)==0) {
+    if (left >= 8 && memcmp(jsondata->ptr, "Infinity", 8)==0) {
         jsondata->ptr += 8;
         object = PyFloat_FromDouble(INFINITY);
         return object;
-    } else if (left >= 9 && strncmp(jsondata->ptr, "+Infinity", 9)==0) {
+    } else if (left >= 9 && memcmp(jsondata->ptr, "+Infinity", 9)==0) {
         jsondata->ptr += 9;
         object = PyFloat_FromDouble(INFINITY);
         return object;
-    } else if (left >= 9 && strncmp(jsondata->ptr, "-Infinity", 9)==0) {
+    } else if (left >= 9 && memcmp(jsondata->ptr, "-Infinity", 9)==0) {
         jsondata->ptr += 9;
         object = PyFloat_FromDouble(-INFINITY);
         return object;
+    } else if (incomplete_literal(jsondata, "Infinity", 8) ||
+               incomplete_literal(jsondata, "+Infinity", 9) ||
+               incomplete_literal(jsondata, "-Infinity", 9)) {
+        return NULL;
     } else {
-        PyErr_Format(JSON_DecodeError, "cannot parse JSON description: %.20s",
-                     jsondata->ptr);
+        raise_parse_error(jsondata);
         return NULL;
     }
 }
@@ -237,66 +893,79 @@ decode_nan(JSONData *jsondata)
 
     left = jsondata->end - jsondata->ptr;
 
-    if (left >= 3 && strncmp(jsondata->ptr, "NaN", 3)==0) {
+    if (left >= 3 && memcmp(jsondata->ptr, "NaN", 3)==0) {
         jsondata->ptr += 3;
         object = PyFloat_FromDouble(NAN);
         return object;
+    } else if (incomplete_literal(jsondata, "NaN", 3)) {
+        return NULL;
     } else {
-        PyErr_Format(JSON_DecodeError, "cannot parse JSON description: %.20s",
-                     jsondata->ptr);
+        raise_parse_error(jsondata);
         return NULL;
     }
 }
 
 
-#define skipDigits(ptr) while(isdigit(*(ptr))) (ptr)++
+#define isDigit(ptr, end) ((ptr) < (end) && isDigitChar(*(ptr)))
+#define skipDigits(ptr, end) while(isDigit(ptr, end)) (ptr)++
 
 static PyObject*
 decode_number(JSONData *jsondata)
 {
     PyObject *object, *str;
     int is_float;
-    char *ptr;
+    char *ptr, *end;
 
     // validate number and check if it's floating point or not
     ptr = jsondata->ptr;
+    end = jsondata->end;
     is_float = False;
 
-    if (*ptr == '-' || *ptr == '+')
+    if (ptr < end && (*ptr == '-' || *ptr == '+'))
         ptr++;
 
-    if (*ptr == '0') {
+    if (ptr < end && *ptr == '0') {
         ptr++;
-        if (isdigit(*ptr))
+        if (isDigit(ptr, end))
             goto number_error;
-    } else if (isdigit(*ptr))
-        skipDigits(ptr);
+    } else if (isDigit(ptr, end))
+        skipDigits(ptr, end);
     else
         goto number_error;
 
-    if (*ptr == '.') {
+    if (ptr < end && *ptr == '.') {
        is_float = True;
        ptr++;
-       if (!isdigit(*ptr))
+       if (!isDigit(ptr, end))
            goto number_error;
-       skipDigits(ptr);
+       skipDigits(ptr, end);
     }
 
-    if (*ptr == 'e' || *ptr == 'E') {
+    if (ptr < end && (*ptr == 'e' || *ptr == 'E')) {
        is_float = True;
        ptr++;
-       if (*ptr == '+' || *ptr == '-')
+       if (ptr < end && (*ptr == '+' || *ptr == '-'))
            ptr++;
-       if (!isdigit(*ptr))
+       if (!isDigit(ptr, end))
            goto number_error;
-       skipDigits(ptr);
+       skipDigits(ptr, end);
+    }
+
+    // the number may continue in the input that follows
+    if (ptr == jsondata->end && jsondata->partial) {
+        jsondata->incomplete = True;
+        return NULL;
     }
 
     str = PyString_FromStringAndSize(jsondata->ptr, ptr - jsondata->ptr);
     if (str == NULL)
         return NULL;
 
-    if (is_float)
+    if (jsondata->raw_numbers)
+        object = make_raw_number(str);
+    else if (is_float && jsondata->decimal_type != NULL)
+        object = PyObject_CallFunctionObjArgs(jsondata->decimal_type, str, NULL);
+    else if (is_float)
         object = PyFloat_FromString(str, NULL);
     else
         object = PyInt_FromString(PyString_AS_STRING(str), NULL, 10);
@@ -311,247 +980,452 @@ decode_number(JSONData *jsondata)
     return object;
 
 number_error:
-    PyErr_Format(JSON_DecodeError, "invalid number starting at position "
-                 SSIZE_T_F, (Py_ssize_t)(jsondata->ptr - jsondata->str));
+    if (ptr == jsondata->end && jsondata->partial) {
+        jsondata->incomplete = True;
+        return NULL;
+    }
+    raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                       "invalid number starting at position " SSIZE_T_F,
+                       position(jsondata, jsondata->ptr));
     return NULL;
 }
 
 
+/*
+ * Skip over the JSON value at the current position without decoding it. Only
+ * strings and the nesting of arrays and objects are followed to find where
+ * the value ends, so the callers must check the rest of it when they decode
+ * it (see scan_skip_value for values that are never decoded). Returns 0 on
+ * success and -1 with an exception set on error.
+ */
+static int
+skip_value(JSONData *jsondata)
+{
+    StringScan scan;
+    Py_ssize_t depth;
+    char *ptr, *end, *quote;
+    int c;
+
+    ptr = jsondata->ptr;
+    end = jsondata->end;
+    depth = 0;
+
+    while (ptr < end) {
+        c = *ptr;
+        if (c == '"') {
+            quote = ptr;
+            scan.escaping = scan.has_unicode = scan.string_escape = False;
+            ptr = scan_string(ptr+1, end, &scan);
+            if (ptr == NULL) {
+                raise_decode_error(jsondata, position(jsondata, quote),
+                                   "unterminated string starting"
+                                   " at position " SSIZE_T_F,
+                                   position(jsondata, quote));
+                return -1;
+            }
+            ptr++;
+        } else if (c == '[' || c == '{') {
+            depth++;
+            ptr++;
+        } else if (c == ']' || c == '}') {
+            if (depth == 0)
+                break;
+            depth--;
+            ptr++;
+        } else if (depth == 0 && (c == ',' || c == ':' || isSpace(c))) {
+            break;
+        } else {
+            ptr++;
+        }
+        // strings, arrays and objects end with their closing character
+        if (depth == 0 && (c == '"' || c == ']' || c == '}'))
+            break;
+    }
+
+    if (depth > 0) {
+        raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                           "unterminated %s starting at position " SSIZE_T_F,
+                           *jsondata->ptr=='[' ? "array" : "object",
+                           position(jsondata, jsondata->ptr));
+        return -1;
+    } else if (ptr == jsondata->ptr) {
+        if (ptr == end)
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "empty JSON description");
+        else
+            raise_parse_error(jsondata);
+        return -1;
+    }
+
+    jsondata->ptr = ptr;
+
+    return 0;
+}
+
+
 typedef enum {
     ArrayItem_or_ClosingBracket=0,
     Comma_or_ClosingBracket,
     ArrayItem,
-    ArrayDone
-} ArrayState;
+    DictionaryKey_or_ClosingBrace,
+    Comma_or_ClosingBrace,
+    DictionaryKey,
+    Colon,
+    DictionaryValue
+} ContainerState;
+
 
+/*
+ * Build an array.array from the given numbers, of type 'l' if they are all
+ * integers and of type 'd' if some are floating point numbers and the integers
+ * among them can be converted exactly. Returns NULL without an exception set
+ * if the items are not such numbers.
+ */
 static PyObject*
-decode_array(JSONData *jsondata)
+make_numeric_array(PyObject **items, Py_ssize_t n)
 {
-    PyObject *object, *item;
-    ArrayState next_state;
-    int c, result;
-    char *start;
+    PyObject *object;
+    double *reals;
+    long *integers;
+    int is_real = False;
+    Py_ssize_t i;
 
-    object = PyList_New(0);
+    for (i = 0; i < n; i++) {
+        if (PyFloat_CheckExact(items[i]))
+            is_real = True;
+        else if (!PyInt_CheckExact(items[i]))
+            return NULL;
+    }
 
-    start = jsondata->ptr;
-    jsondata->ptr++;
-
-    next_state = ArrayItem_or_ClosingBracket;
-
-    while (next_state != ArrayDone) {
-        skipSpaces(jsondata);
-        c = *jsondata->ptr;
-        if (c == 0) {
-            PyErr_Format(JSON_DecodeError, "unterminated array starting at "
-                         "position " SSIZE_T_F,
-                         (Py_ssize_t)(start - jsondata->str));
-            goto failure;
-        }
-        switch (next_state) {
-        case ArrayItem_or_ClosingBracket:
-            if (c == ']') {
-                jsondata->ptr++;
-                next_state = ArrayDone;
-                break;
-            }
-        case ArrayItem:
-            if (c==',' || c==']') {
-                PyErr_Format(JSON_DecodeError, "expecting array item at "
-                             "position " SSIZE_T_F,
-                             (Py_ssize_t)(jsondata->ptr - jsondata->str));
-                goto failure;
-            }
-            item = decode_json(jsondata);
-            if (item == NULL)
-                goto failure;
-            result = PyList_Append(object, item);
-            Py_DECREF(item);
-            if (result == -1)
-                goto failure;
-            next_state = Comma_or_ClosingBracket;
-            break;
-        case Comma_or_ClosingBracket:
-            if (c == ']') {
-                jsondata->ptr++;
-                next_state = ArrayDone;
-            } else if (c == ',') {
-                jsondata->ptr++;
-                next_state = ArrayItem;
+    if (is_real) {
+        reals = PyMem_New(double, n);
+        if (reals == NULL)
+            return PyErr_NoMemory();
+        for (i = 0; i < n; i++) {
+            if (PyFloat_CheckExact(items[i])) {
+                reals[i] = PyFloat_AS_DOUBLE(items[i]);
+            } else if (PyInt_AS_LONG(items[i]) > MAX_EXACT_DOUBLE_INTEGER ||
+                       PyInt_AS_LONG(items[i]) < -MAX_EXACT_DOUBLE_INTEGER) {
+                PyMem_Free(reals);
+                return NULL;
             } else {
-                PyErr_Format(JSON_DecodeError, "expecting ',' or ']' at "
-                             "position " SSIZE_T_F,
-                             (Py_ssize_t)(jsondata->ptr - jsondata->str));
-                goto failure;
+                reals[i] = (double)PyInt_AS_LONG(items[i]);
             }
-            break;
-        case ArrayDone:
-            // this will never be reached, but keep compilers happy
-            break;
         }
+        object = make_typed_array("d", reals, n * sizeof(double));
+        PyMem_Free(reals);
+    } else {
+        integers = PyMem_New(long, n);
+        if (integers == NULL)
+            return PyErr_NoMemory();
+        for (i = 0; i < n; i++)
+            integers[i] = PyInt_AS_LONG(items[i]);
+        object = make_typed_array("l", integers, n * sizeof(long));
+        PyMem_Free(integers);
     }
 
     return object;
-
-failure:
-    Py_DECREF(object);
-    return NULL;
 }
 
 
-typedef enum {
-    DictionaryKey_or_ClosingBrace=0,
-    Comma_or_ClosingBrace,
-    DictionaryKey,
-    DictionaryDone
-} DictionaryState;
-
+// Build the list (or tuple) from the items collected on the stack above base
 static PyObject*
-decode_object(JSONData *jsondata)
+make_array(JSONData *jsondata, Py_ssize_t base)
 {
-    PyObject *object, *key, *value;
-    DictionaryState next_state;
-    int c, result;
-    char *start;
+    PyObject *object;
+    Py_ssize_t i, n;
 
-    object = PyDict_New();
+    n = jsondata->stack.size - base;
 
-    start = jsondata->ptr;
-    jsondata->ptr++;
+    if (jsondata->numeric_arrays && n > 0) {
+        object = make_numeric_array(jsondata->stack.items + base, n);
+        if (object != NULL)
+            stack_pop_to(&jsondata->stack, base);
+        if (object != NULL || PyErr_Occurred())
+            return object;
+    }
+    object = jsondata->tuple_arrays ? PyTuple_New(n) : PyList_New(n);
+    if (object == NULL)
+        return NULL;
 
-    next_state = DictionaryKey_or_ClosingBrace;
+    // move the item references from the stack into the array
+    if (jsondata->tuple_arrays) {
+        for (i = 0; i < n; i++)
+            PyTuple_SET_ITEM(object, i, jsondata->stack.items[base+i]);
+    } else {
+        for (i = 0; i < n; i++)
+            PyList_SET_ITEM(object, i, jsondata->stack.items[base+i]);
+    }
+    jsondata->stack.size = base;
 
-    while (next_state != DictionaryDone) {
-        skipSpaces(jsondata);
-        c = *jsondata->ptr;
-        if (c == 0) {
-            PyErr_Format(JSON_DecodeError, "unterminated object starting at "
-                         "position " SSIZE_T_F,
-                         (Py_ssize_t)(start - jsondata->str));
-            goto failure;;
-        }
-
-        switch (next_state) {
-        case DictionaryKey_or_ClosingBrace:
-            if (c == '}') {
-                jsondata->ptr++;
-                next_state = DictionaryDone;
-                break;
-            }
-        case DictionaryKey:
-            if (c != '"') {
-                PyErr_Format(JSON_DecodeError, "expecting object property name "
-                             "at position " SSIZE_T_F,
-                             (Py_ssize_t)(jsondata->ptr - jsondata->str));
-                goto failure;
-            }
+    return object;
+}
 
-            key = decode_json(jsondata);
-            if (key == NULL)
-                goto failure;
 
-            skipSpaces(jsondata);
-            if (*jsondata->ptr != ':') {
-                PyErr_Format(JSON_DecodeError, "missing colon after object "
-                             "property name at position " SSIZE_T_F,
-                             (Py_ssize_t)(jsondata->ptr - jsondata->str));
-                Py_DECREF(key);
-                goto failure;
-            } else {
-                jsondata->ptr++;
-            }
+/*
+ * Build the object from the key/value pairs collected on the stack above base.
+ * With an object_pairs_hook the pairs are passed to it as a tuple and no
+ * dictionary is built, otherwise the dictionary is passed to the object_hook
+ * if there is one.
+ */
+static PyObject*
+make_object(JSONData *jsondata, Py_ssize_t base)
+{
+    PyObject *object, *key, *value, *pairs, *pair;
+    Py_ssize_t i;
 
-            skipSpaces(jsondata);
-            if (*jsondata->ptr==',' || *jsondata->ptr=='}') {
-                PyErr_Format(JSON_DecodeError, "expecting object property "
-                             "value at position " SSIZE_T_F,
-                             (Py_ssize_t)(jsondata->ptr - jsondata->str));
-                Py_DECREF(key);
-                goto failure;
+    if (jsondata->object_pairs_hook != NULL) {
+        pairs = PyTuple_New((jsondata->stack.size - base) / 2);
+        if (pairs == NULL)
+            return NULL;
+        for (i = base; i < jsondata->stack.size; i += 2) {
+            pair = PyTuple_Pack(2, jsondata->stack.items[i], jsondata->stack.items[i+1]);
+            if (pair == NULL) {
+                Py_DECREF(pairs);
+                return NULL;
             }
+            PyTuple_SET_ITEM(pairs, (i - base) / 2, pair);
+        }
+        stack_pop_to(&jsondata->stack, base);
+        object = PyObject_CallFunctionObjArgs(jsondata->object_pairs_hook, pairs, NULL);
+        Py_DECREF(pairs);
+        return object;
+    }
 
-            value = decode_json(jsondata);
-            if (value == NULL) {
-                Py_DECREF(key);
-                goto failure;
-            }
+    object = _PyDict_NewPresized((jsondata->stack.size - base) / 2);
+    if (object == NULL)
+        return NULL;
 
-            result = PyDict_SetItem(object, key, value);
-            Py_DECREF(key);
-            Py_DECREF(value);
-            if (result == -1)
-                goto failure;
-            next_state = Comma_or_ClosingBrace;
-            break;
-        case Comma_or_ClosingBrace:
-            if (c == '}') {
-                jsondata->ptr++;
-                next_state = DictionaryDone;
-            } else if (c == ',') {
-                jsondata->ptr++;
-                next_state = DictionaryKey;
-            } else {
-                PyErr_Format(JSON_DecodeError, "expecting ',' or '}' at "
-                             "position " SSIZE_T_F,
-                             (Py_ssize_t)(jsondata->ptr - jsondata->str));
-                goto failure;
-            }
-            break;
-        case DictionaryDone:
-            // this will never be reached, but keep compilers happy
-            break;
+    // insert the members in document order, so the last duplicate key wins
+    for (i = base; i < jsondata->stack.size; i += 2) {
+        key = jsondata->stack.items[i];
+        value = jsondata->stack.items[i+1];
+        if (PyDict_SetItem(object, key, value) == -1) {
+            Py_DECREF(object);
+            return NULL;
         }
     }
+    stack_pop_to(&jsondata->stack, base);
+
+    if (jsondata->object_hook != NULL) {
+        value = PyObject_CallFunctionObjArgs(jsondata->object_hook, object, NULL);
+        Py_DECREF(object);
+        object = value;
+    }
 
     return object;
+}
 
-failure:
-    Py_DECREF(object);
-    return NULL;
+
+// Open an array or object, optionally decoding only the selected fields of it
+static int
+open_container(JSONData *jsondata, int type, PyObject *fields)
+{
+    ContainerStack *containers = &jsondata->containers;
+    Container *container;
+
+    if (containers->size >= jsondata->max_depth) {
+        raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                           "maximum nesting depth of " SSIZE_T_F
+                           " exceeded at position " SSIZE_T_F,
+                           jsondata->max_depth, position(jsondata, jsondata->ptr));
+        return -1;
+    }
+
+    if (containers->size == containers->allocated) {
+        Container *items;
+        Py_ssize_t allocated;
+
+        allocated = containers->allocated ? containers->allocated*2 : CONTAINER_STACK_INITIAL_SIZE;
+        items = scratch_resize(containers->items, &allocated, sizeof(Container));
+        if (items == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        containers->items = items;
+        containers->allocated = allocated;
+    }
+
+    container = &containers->items[containers->size++];
+    container->type = type;
+    container->state = type=='[' ? ArrayItem_or_ClosingBracket : DictionaryKey_or_ClosingBrace;
+    container->start = position(jsondata, jsondata->ptr);
+    container->base = jsondata->stack.size;
+    container->fields = container->member_fields = NULL;
+
+    if (fields != NULL) {
+        if (type == '{') {
+            container->fields = fields;
+        } else {
+            // a selection only applies to the items of an array through [*]
+            container->member_fields = PyDict_GetItem(fields, Py_None);
+            if (container->member_fields != NULL) {
+                container->fields = fields;
+                if (container->member_fields == Py_None)
+                    container->member_fields = NULL;
+            }
+        }
+    }
+
+    jsondata->ptr++;
+
+    return 0;
+}
+
+
+// Make an (event, value) tuple. The value reference is stolen and can be NULL
+static PyObject*
+make_event(JSONEvent event, PyObject *value)
+{
+    PyObject *tuple;
+
+    if (value == NULL) {
+        Py_INCREF(Py_None);
+        value = Py_None;
+    }
+
+    tuple = PyTuple_New(2);
+    if (tuple == NULL) {
+        Py_DECREF(value);
+        return NULL;
+    }
+    Py_INCREF(event_names[event]);
+    PyTuple_SET_ITEM(tuple, 0, event_names[event]);
+    PyTuple_SET_ITEM(tuple, 1, value);
+
+    return tuple;
+}
+
+
+// Skip over the colon and the value of an object member that is not selected
+static int
+skip_member(JSONData *jsondata, Container *container)
+{
+    skipSpaces(jsondata);
+    if (jsondata->ptr == jsondata->end)
+        goto unterminated;
+    if (*jsondata->ptr != ':') {
+        raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                           "missing colon after object property name"
+                           " at position " SSIZE_T_F,
+                           position(jsondata, jsondata->ptr));
+        return -1;
+    }
+    jsondata->ptr++;
+    skipSpaces(jsondata);
+    if (jsondata->ptr == jsondata->end)
+        goto unterminated;
+    if (*jsondata->ptr==',' || *jsondata->ptr=='}') {
+        raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                           "expecting object property value at position " SSIZE_T_F,
+                           position(jsondata, jsondata->ptr));
+        return -1;
+    }
+    return scan_skip_value(jsondata);
+
+unterminated:
+    raise_decode_error(jsondata, container->start,
+                       "unterminated object starting at position " SSIZE_T_F,
+                       container->start);
+    return -1;
 }
 
 
+/*
+ * Decode a JSON value, including all the arrays and objects nested in it.
+ *
+ * This is an iterative state machine. The arrays and objects that are being
+ * decoded are kept on a heap allocated container stack, each recording the
+ * next element it expects, while their already decoded items are collected
+ * on the object stack. This way the nesting depth is only limited by the
+ * max_depth option and never by the C stack or the interpreter recursion
+ * limit.
+ *
+ * When the input is partial and ends before the value is complete, it will
+ * return NULL without setting an exception and flag the decoder as being
+ * incomplete. The decoder state is preserved in that case and calling it
+ * again after more input was added will continue from where it stopped.
+ *
+ * In events mode it doesn't build the value, instead it returns an (event,
+ * value) tuple for every element of the value as it is parsed and returns
+ * to the caller, which must call it again for the next event until the
+ * container stack becomes empty.
+ *
+ * When fields are selected, only the selected members of objects are decoded
+ * and the values of the other members are skipped without building them.
+ * Field selection is not supported together with partial input or events.
+ */
 static PyObject*
 decode_json(JSONData *jsondata)
 {
-    PyObject *object;
+    ContainerStack *containers = &jsondata->containers;
+    Container *container;
+    PyObject *object, *fields;
+    JSONEvent event;
+    int c;
 
+    jsondata->incomplete = False;
+    event = NullEvent;
+
+    // continue decoding a value that was previously left incomplete
+    if (containers->size > 0)
+        goto next_element;
+
+parse_value:
     skipSpaces(jsondata);
+    if (jsondata->ptr == jsondata->end) {
+        if (jsondata->partial) {
+            jsondata->incomplete = True;
+            goto failure;
+        }
+        raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                           "empty JSON description");
+        goto failure;
+    }
     switch(*jsondata->ptr) {
-    case 0:
-        PyErr_SetString(JSON_DecodeError, "empty JSON description");
-        return NULL;
     case '{':
-        if (Py_EnterRecursiveCall(" while decoding a JSON object"))
-            return NULL;
-        object = decode_object(jsondata);
-        Py_LeaveRecursiveCall();
-        break;
     case '[':
-        if (Py_EnterRecursiveCall(" while decoding a JSON array"))
-            return NULL;
-        object = decode_array(jsondata);
-        Py_LeaveRecursiveCall();
-        break;
+        c = *jsondata->ptr;
+        if (jsondata->fields == NULL)
+            fields = NULL;
+        else if (containers->size == 0)
+            fields = jsondata->fields;
+        else
+            fields = containers->items[containers->size-1].member_fields;
+        if (open_container(jsondata, c, fields) == -1)
+            goto failure;
+        if (jsondata->events) {
+            object = make_event(c=='[' ? StartArrayEvent : StartMapEvent, NULL);
+            if (object == NULL)
+                goto failure;
+            return object;
+        }
+        goto next_element;
     case '"':
         object = decode_string(jsondata);
+        event = StringEvent;
         break;
     case 't':
     case 'f':
         object = decode_bool(jsondata);
+        event = BooleanEvent;
         break;
     case 'n':
         object = decode_null(jsondata);
+        event = NullEvent;
         break;
     case 'N':
         object = decode_nan(jsondata);
+        event = NumberEvent;
         break;
     case 'I':
         object = decode_inf(jsondata);
+        event = NumberEvent;
         break;
     case '+':
     case '-':
-        if (*(jsondata->ptr+1) == 'I') {
+        event = NumberEvent;
+        if (jsondata->ptr+1 < jsondata->end && *(jsondata->ptr+1) == 'I') {
             object = decode_inf(jsondata);
             break;
         }
@@ -567,58 +1441,1701 @@ decode_json(JSONData *jsondata)
     case '8':
     case '9':
         object = decode_number(jsondata);
+        event = NumberEvent;
         break;
     default:
-        PyErr_SetString(JSON_DecodeError, "cannot parse JSON description");
-        return NULL;
+        raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                           "cannot parse JSON description");
+        goto failure;
+    }
+
+    if (object == NULL)
+        goto failure;
+
+value_done:
+    if (containers->size == 0)
+        goto return_value;
+    if (!jsondata->events && stack_push(&jsondata->stack, object) == -1)
+        goto failure;
+
+    // move the enclosing container past the element that was just decoded
+    container = &containers->items[containers->size-1];
+    switch (container->state) {
+    case ArrayItem_or_ClosingBracket:
+    case ArrayItem:
+        container->state = Comma_or_ClosingBracket;
+        break;
+    case DictionaryKey_or_ClosingBrace:
+    case DictionaryKey:
+        container->state = Colon;
+        break;
+    default:
+        container->state = Comma_or_ClosingBrace;
+        break;
+    }
+
+    if (jsondata->events)
+        goto return_value;
+
+next_element:
+    container = &containers->items[containers->size-1];
+
+    skipSpaces(jsondata);
+    if (jsondata->ptr == jsondata->end) {
+        if (jsondata->partial) {
+            jsondata->incomplete = True;
+            goto failure;
+        }
+        raise_decode_error(jsondata, container->start,
+                           "unterminated %s starting at position " SSIZE_T_F,
+                           container->type=='[' ? "array" : "object",
+                           container->start);
+        goto failure;
+    }
+
+    c = *jsondata->ptr;
+    switch (container->state) {
+    case ArrayItem_or_ClosingBracket:
+        if (c == ']')
+            goto close_container;
+    case ArrayItem:
+        if (c==',' || c==']') {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "expecting array item at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            goto failure;
+        }
+        goto parse_value;
+    case Comma_or_ClosingBracket:
+        if (c == ']') {
+            goto close_container;
+        } else if (c == ',') {
+            jsondata->ptr++;
+            container->state = ArrayItem;
+            goto next_element;
+        } else {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "expecting ',' or ']' at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            goto failure;
+        }
+    case DictionaryKey_or_ClosingBrace:
+        if (c == '}')
+            goto close_container;
+    case DictionaryKey:
+        if (c != '"') {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "expecting object property name"
+                               " at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            goto failure;
+        }
+        object = decode_string(jsondata);
+        if (object == NULL)
+            goto failure;
+        if (container->fields != NULL) {
+            container->member_fields = PyDict_GetItem(container->fields, object);
+            if (container->member_fields == NULL) {
+                // the member is not selected
+                Py_DECREF(object);
+                if (skip_member(jsondata, container) == -1)
+                    goto failure;
+                container->state = Comma_or_ClosingBrace;
+                goto next_element;
+            }
+            if (container->member_fields == Py_None)
+                container->member_fields = NULL;
+        }
+        event = MapKeyEvent;
+        goto value_done;
+    case Colon:
+        if (c != ':') {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "missing colon after object property name"
+                               " at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            goto failure;
+        }
+        jsondata->ptr++;
+        container->state = DictionaryValue;
+        goto next_element;
+    case DictionaryValue:
+        if (c==',' || c=='}') {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "expecting object property value"
+                               " at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            goto failure;
+        }
+        goto parse_value;
+    case Comma_or_ClosingBrace:
+        if (c == '}') {
+            goto close_container;
+        } else if (c == ',') {
+            jsondata->ptr++;
+            container->state = DictionaryKey;
+            goto next_element;
+        } else {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "expecting ',' or '}' at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            goto failure;
+        }
+    }
+
+close_container:
+    jsondata->ptr++;
+    if (jsondata->events) {
+        event = container->type=='[' ? EndArrayEvent : EndMapEvent;
+        object = NULL;
+    } else if (container->type == '[') {
+        object = make_array(jsondata, container->base);
+    } else {
+        object = make_object(jsondata, container->base);
+    }
+    containers->size--;
+    if (object == NULL && !jsondata->events)
+        goto failure;
+    goto value_done;
+
+return_value:
+    if (jsondata->events) {
+        object = make_event(event, object);
+        if (object == NULL)
+            goto failure;
+    }
+    return object;
+
+failure:
+    if (!jsondata->incomplete) {
+        containers->size = 0;
+        stack_pop_to(&jsondata->stack, 0);
+    }
+    return NULL;
+}
+
+
+// Decode the JSON value that makes up the whole input
+static PyObject*
+decode_document(JSONData *jsondata)
+{
+    PyObject *object;
+
+    object = decode_json(jsondata);
+
+    if (object != NULL) {
+        skipSpaces(jsondata);
+        if (jsondata->ptr < jsondata->end) {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "extra data after JSON description"
+                               " at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            Py_DECREF(object);
+            return NULL;
+        }
     }
 
     return object;
 }
 
 
-/* ------------------------------ Encoding ----------------------------- */
+/* ------------------------------ Scanning ----------------------------- */
 
 /*
- * This function is an almost verbatim copy of PyString_Repr() from
- * Python's stringobject.c with the following differences:
+ * The scanner below checks the same grammar as decode_json without creating
+ * any python objects or calling into the python API, so it can run with the
+ * GIL released. It reports the first error as a ScanError code and the input
+ * position where it was found.
  *
- * - it always quotes the output using double quotes.
- * - it also quotes \b and \f
- * - it replaces any non ASCII character hh with \u00hh instead of \xhh
+ * When given a tape, it also records the values it scans on it, in the order
+ * they would be pushed on the object stack by decode_json, with every array
+ * and object represented by an entry that follows its members. Numbers and
+ * strings are parsed and unescaped into the tape whenever that can be done
+ * exactly without python, the others are recorded as input spans which are
+ * decoded by build_tape while holding the GIL.
  */
-static PyObject*
-encode_string(PyObject *string)
+
+typedef enum {
+    TapeNull=0,
+    TapeTrue,
+    TapeFalse,
+    TapeInteger, // integer parsed into value.integer
+    TapeFloat, // floating point number parsed into value.real
+    TapeNumber, // number that needs decode_number, at value.ptr
+    TapeString, // string without escapes, value.ptr and length
+    TapeEscapedString, // unescaped string at value.offset in the tape strings
+    TapeRawString, // string that needs decode_string, at value.ptr
+    TapeArray, // array with length items, following the items
+    TapeObject, // object with length members, following the members
+    TapeNumericArray // array of length numbers, preceding the numbers
+} TapeType;
+
+typedef struct TapeEntry {
+    int type; // one of TapeType
+    Py_ssize_t length; // string length or number of array or object members
+    union {
+        char *ptr; // position of the value in the input
+        Py_ssize_t offset; // position of an unescaped string in the strings
+        PY_LONG_LONG integer;
+        double real;
+    } value;
+} TapeEntry;
+
+typedef struct Tape {
+    TapeEntry *entries; // the scanned values
+    Py_ssize_t size; // number of entries
+    Py_ssize_t allocated; // number of slots allocated in entries
+    char *strings; // the unescaped strings
+    Py_ssize_t strings_size; // the space used in strings
+    Py_ssize_t strings_allocated; // the space allocated for strings
+} Tape;
+
+typedef struct ScanContainer {
+    char *start; // the opening bracket or brace
+    Py_ssize_t count; // number of array items or object members so far
+    Py_ssize_t first; // the first tape entry of the members
+} ScanContainer;
+
+typedef struct Scanner {
+    char *str; // the JSON input
+    char *end; // pointer to the input end
+    char *ptr; // pointer to the current scanning position
+    Py_ssize_t max_depth; // maximum nesting depth of arrays and objects
+    ScanContainer *containers; // the open arrays and objects, innermost last
+    Py_ssize_t allocated; // number of slots allocated in containers
+    Tape *tape; // where the scanned values are recorded (can be NULL)
+    int float_spans; // record floating point numbers as input spans
+    int integer_spans; // record integers as input spans
+    int numeric_arrays; // record arrays of numbers ahead of their items
+    int single_value; // stop after the first value instead of at the input end
+    ScanError error; // the first error found
+    char *error_ptr; // where the error was found
+} Scanner;
+
+#define TAPE_INITIAL_SIZE 256
+
+// smaller inputs are scanned without releasing the GIL, as they take less
+// time than switching threads does
+#define SCAN_RELEASE_GIL_SIZE 65536
+
+#define scanSpaces(s) while((s)->ptr < (s)->end && isSpace(*((s)->ptr))) (s)->ptr++
+#define isHexDigit(ptr, end) ((ptr) < (end) && isHexDigitChar(*(ptr)))
+
+// the powers of ten that are exactly representable as doubles
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+// Initialize the tape with cached buffers if there are any. As the tape grows
+// while the GIL is released, it cannot take them from the cache later
+static void
+tape_init(Tape *tape)
 {
-    register PyStringObject* op = (PyStringObject*) string;
-    size_t newsize = 2 + 6 * op->ob_size;
-    PyObject *v;
+    size_t size;
+
+    size = TAPE_INITIAL_SIZE * sizeof(TapeEntry);
+    tape->entries = scratch_get(&size);
+    tape->allocated = tape->entries ? size / sizeof(TapeEntry) : 0;
+    tape->size = 0;
+    size = 1;
+    tape->strings = scratch_get(&size);
+    tape->strings_allocated = tape->strings ? size : 0;
+    tape->strings_size = 0;
+}
 
-    if (op->ob_size > (PY_SSIZE_T_MAX-2)/6) {
-        PyErr_SetString(PyExc_OverflowError,
-                        "string is too large to make repr");
-        return NULL;
-    }
-    v = PyString_FromStringAndSize((char *)NULL, newsize);
-    if (v == NULL) {
-        return NULL;
-    }
-    else {
-        register Py_ssize_t i;
-        register char c;
-        register char *p;
-        int quote;
 
-        quote = '"';
+static void
+tape_free(Tape *tape)
+{
+    scratch_put(tape->entries, tape->allocated * sizeof(TapeEntry));
+    scratch_put(tape->strings, tape->strings_allocated);
+    tape->entries = NULL;
+    tape->strings = NULL;
+    tape->size = tape->allocated = 0;
+    tape->strings_size = tape->strings_allocated = 0;
+}
 
-        p = PyString_AS_STRING(v);
-        *p++ = quote;
-        for (i = 0; i < op->ob_size; i++) {
-            /* There's at least enough room for a hex escape
-             and a closing quote. */
-            assert(newsize - (p - PyString_AS_STRING(v)) >= 7);
-            c = op->ob_sval[i];
-            if (c == quote || c == '\\')
+
+static int
+scan_error(Scanner *scanner, ScanError error, char *ptr)
+{
+    scanner->error = error;
+    scanner->error_ptr = ptr;
+    return -1;
+}
+
+
+// Add a new entry to the tape. Returns NULL when out of memory
+static TapeEntry*
+tape_add(Scanner *scanner, int type)
+{
+    Tape *tape = scanner->tape;
+
+    if (tape->size == tape->allocated) {
+        TapeEntry *entries;
+        Py_ssize_t allocated;
+
+        allocated = tape->allocated ? tape->allocated*2 : TAPE_INITIAL_SIZE;
+        if (allocated > PY_SSIZE_T_MAX / (Py_ssize_t)sizeof(TapeEntry))
+            entries = NULL;
+        else
+            entries = realloc(tape->entries, allocated * sizeof(TapeEntry));
+        if (entries == NULL) {
+            scan_error(scanner, OutOfMemory, scanner->ptr);
+            return NULL;
+        }
+        tape->entries = entries;
+        tape->allocated = allocated;
+    }
+
+    tape->entries[tape->size].type = type;
+    return &tape->entries[tape->size++];
+}
+
+
+static int
+tape_add_value(Scanner *scanner, int type, char *ptr, Py_ssize_t length)
+{
+    TapeEntry *entry = tape_add(scanner, type);
+
+    if (entry == NULL)
+        return -1;
+    entry->length = length;
+    entry->value.ptr = ptr;
+    return 0;
+}
+
+
+static int
+tape_add_real(Scanner *scanner, double real)
+{
+    TapeEntry *entry = tape_add(scanner, TapeFloat);
+
+    if (entry == NULL)
+        return -1;
+    entry->value.real = real;
+    return 0;
+}
+
+
+/*
+ * Unescape a string that only uses the escapes handled below into the tape
+ * strings. These are the ones PyString_DecodeEscape translates the same way.
+ */
+static int
+tape_add_escaped_string(Scanner *scanner, char *ptr, char *end)
+{
+    Tape *tape = scanner->tape;
+    TapeEntry *entry;
+    char *output;
+
+    if (end - ptr > tape->strings_allocated - tape->strings_size) {
+        char *strings;
+        Py_ssize_t allocated;
+
+        allocated = tape->strings_allocated ? tape->strings_allocated : TAPE_INITIAL_SIZE;
+        while (allocated - tape->strings_size < end - ptr && allocated <= PY_SSIZE_T_MAX/2)
+            allocated *= 2;
+        if (allocated - tape->strings_size < end - ptr)
+            strings = NULL;
+        else
+            strings = realloc(tape->strings, allocated);
+        if (strings == NULL)
+            return scan_error(scanner, OutOfMemory, scanner->ptr);
+        tape->strings = strings;
+        tape->strings_allocated = allocated;
+    }
+
+    entry = tape_add(scanner, TapeEscapedString);
+    if (entry == NULL)
+        return -1;
+
+    output = tape->strings + tape->strings_size;
+    for (; ptr < end; ptr++) {
+        if (*ptr != '\\') {
+            *output++ = *ptr;
+            continue;
+        }
+        switch (*++ptr) {
+        case 'b':
+            *output++ = '\b';
+            break;
+        case 'f':
+            *output++ = '\f';
+            break;
+        case 'n':
+            *output++ = '\n';
+            break;
+        case 'r':
+            *output++ = '\r';
+            break;
+        case 't':
+            *output++ = '\t';
+            break;
+        default: // '"' and '\\'
+            *output++ = *ptr;
+            break;
+        }
+    }
+
+    entry->value.offset = tape->strings_size;
+    entry->length = output - (tape->strings + tape->strings_size);
+    tape->strings_size += entry->length;
+
+    return 0;
+}
+
+
+static int
+scan_literal(Scanner *scanner, const char *literal, ptrdiff_t length, int type)
+{
+    if (scanner->end - scanner->ptr >= length && memcmp(scanner->ptr, literal, length)==0) {
+        scanner->ptr += length;
+        if (scanner->tape == NULL)
+            return 0;
+        switch (type) {
+        case TapeFloat:
+            if (*literal == 'N')
+                return tape_add_real(scanner, NAN);
+            return tape_add_real(scanner, *literal=='-' ? -INFINITY : INFINITY);
+        default:
+            return tape_add_value(scanner, type, NULL, 0);
+        }
+    }
+    return scan_error(scanner, CannotParse, scanner->ptr);
+}
+
+
+/*
+ * Record a number on the tape. Integers are parsed if they fit in 18 digits.
+ * Floating point numbers are only parsed when both the digits and the power
+ * of ten are exactly representable as doubles, in which case a single
+ * multiplication or division gives the correctly rounded result (Clinger's
+ * fast path). The others are left to decode_number.
+ */
+static int
+tape_add_number(Scanner *scanner, char *start, char *exponent)
+{
+    char *ptr = start, *end = scanner->ptr;
+    PY_LONG_LONG mantissa;
+    TapeEntry *entry;
+    int negative, digits, scale, power, exp_digits;
+    double real;
+
+    if (scanner->integer_spans && scanner->float_spans)
+        return tape_add_value(scanner, TapeNumber, start, end - start);
+
+    negative = (*ptr == '-');
+    if (*ptr == '-' || *ptr == '+')
+        ptr++;
+
+    mantissa = 0;
+    digits = scale = 0;
+    for (; ptr < exponent; ptr++) {
+        if (*ptr == '.') {
+            scale = exponent - ptr - 1;
+            continue;
+        }
+        if (digits > 0 || *ptr != '0')
+            digits++;
+        if (digits > 18)
+            return tape_add_value(scanner, TapeNumber, start, end - start);
+        mantissa = mantissa*10 + (*ptr - '0');
+    }
+
+    if (exponent == end && scale == 0) {
+        if (scanner->integer_spans)
+            return tape_add_value(scanner, TapeNumber, start, end - start);
+        entry = tape_add(scanner, TapeInteger);
+        if (entry == NULL)
+            return -1;
+        entry->value.integer = negative ? -mantissa : mantissa;
+        return 0;
+    } else if (scanner->float_spans) {
+        return tape_add_value(scanner, TapeNumber, start, end - start);
+    }
+
+    power = 0;
+    if (exponent < end) {
+        ptr = exponent + 1;
+        if (*ptr == '-' || *ptr == '+')
+            ptr++;
+        for (exp_digits = 0; ptr < end; ptr++, exp_digits++) {
+            if (exp_digits == 4)
+                return tape_add_value(scanner, TapeNumber, start, end - start);
+            power = power*10 + (*ptr - '0');
+        }
+        if (exponent[1] == '-')
+            power = -power;
+    }
+    power -= scale;
+
+    if (mantissa == 0) {
+        real = 0.0;
+    } else if (digits <= 15 && power >= -22 && power <= 22) {
+        real = (double)mantissa;
+        if (power < 0)
+            real /= exact_powers_of_ten[-power];
+        else
+            real *= exact_powers_of_ten[power];
+    } else {
+        return tape_add_value(scanner, TapeNumber, start, end - start);
+    }
+
+    return tape_add_real(scanner, negative ? -real : real);
+}
+
+
+static int
+scan_number(Scanner *scanner)
+{
+    char *start = scanner->ptr, *ptr = start, *end = scanner->end, *exponent;
+
+    if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+        if (ptr+1 < end && *(ptr+1) == 'I')
+            return scan_literal(scanner, *ptr=='-' ? "-Infinity" : "+Infinity", 9, TapeFloat);
+        ptr++;
+    }
+
+    if (ptr < end && *ptr == '0') {
+        ptr++;
+        if (isDigit(ptr, end))
+            goto number_error;
+    } else if (isDigit(ptr, end))
+        skipDigits(ptr, end);
+    else
+        goto number_error;
+
+    if (ptr < end && *ptr == '.') {
+       ptr++;
+       if (!isDigit(ptr, end))
+           goto number_error;
+       skipDigits(ptr, end);
+    }
+
+    exponent = ptr;
+    if (ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+       ptr++;
+       if (ptr < end && (*ptr == '+' || *ptr == '-'))
+           ptr++;
+       if (!isDigit(ptr, end))
+           goto number_error;
+       skipDigits(ptr, end);
+    }
+
+    scanner->ptr = ptr;
+    if (scanner->tape == NULL)
+        return 0;
+    return tape_add_number(scanner, start, exponent);
+
+number_error:
+    return scan_error(scanner, InvalidNumber, scanner->ptr);
+}
+
+
+/*
+ * Check a string, including the escapes that decode_string would reject. A
+ * \x escape is only decoded (and must be followed by two hex digits) when
+ * the string has other escapes or is decoded as unicode.
+ */
+static int
+scan_string_value(Scanner *scanner)
+{
+    char *ptr, *end = scanner->end;
+    int has_unicode, bad_escape, string_escape, other_escapes;
+
+    has_unicode = bad_escape = string_escape = other_escapes = False;
+
+    for (ptr = scanner->ptr+1; ptr < end; ptr++) {
+        if (*ptr == '"') {
+            break;
+        } else if (*ptr == '\\') {
+            if (++ptr == end)
+                break;
+            switch (*ptr) {
+            case '"':
+            case '\\':
+            case 'b':
+            case 'f':
+            case 'n':
+            case 'r':
+            case 't':
+                string_escape = True;
+                break;
+            case 'u':
+                has_unicode = True;
+                if (!(isHexDigit(ptr+1, end) && isHexDigit(ptr+2, end) &&
+                      isHexDigit(ptr+3, end) && isHexDigit(ptr+4, end)))
+                    return scan_error(scanner, InvalidString, scanner->ptr);
+                break;
+            case 'x':
+                if (!(isHexDigit(ptr+1, end) && isHexDigit(ptr+2, end)))
+                    bad_escape = True;
+                // fall through
+            default:
+                other_escapes = True;
+                break;
+            }
+        } else if (isNonASCII(*ptr)) {
+            has_unicode = True;
+        }
+    }
+
+    if (ptr == end)
+        return scan_error(scanner, UnterminatedString, scanner->ptr);
+    if ((has_unicode || string_escape) && bad_escape)
+        return scan_error(scanner, InvalidString, scanner->ptr);
+
+    end = ptr;
+    ptr = scanner->ptr;
+    scanner->ptr = end + 1;
+
+    if (scanner->tape == NULL)
+        return 0;
+    else if (has_unicode || other_escapes)
+        return tape_add_value(scanner, TapeRawString, ptr, 0);
+    else if (string_escape)
+        return tape_add_escaped_string(scanner, ptr+1, end);
+    else
+        return tape_add_value(scanner, TapeString, ptr+1, end - ptr - 1);
+}
+
+
+static int
+scan_open_container(Scanner *scanner, Py_ssize_t depth)
+{
+    if (depth >= scanner->max_depth)
+        return scan_error(scanner, MaxDepthExceeded, scanner->ptr);
+
+    if (depth == scanner->allocated) {
+        ScanContainer *containers;
+        Py_ssize_t allocated;
+
+        allocated = scanner->allocated*2;
+        if (allocated > PY_SSIZE_T_MAX / (Py_ssize_t)sizeof(ScanContainer))
+            containers = NULL;
+        else if (allocated == CONTAINER_STACK_INITIAL_SIZE*2)
+            containers = malloc(allocated * sizeof(ScanContainer));
+        else
+            containers = realloc(scanner->containers, allocated * sizeof(ScanContainer));
+        if (containers == NULL)
+            return scan_error(scanner, OutOfMemory, scanner->ptr);
+        if (allocated == CONTAINER_STACK_INITIAL_SIZE*2)
+            memcpy(containers, scanner->containers, depth * sizeof(ScanContainer));
+        scanner->containers = containers;
+        scanner->allocated = allocated;
+    }
+
+    scanner->containers[depth].start = scanner->ptr++;
+    scanner->containers[depth].count = 0;
+    scanner->containers[depth].first = scanner->tape ? scanner->tape->size : 0;
+    return 0;
+}
+
+
+// Check if the array members recorded on the tape are all numbers
+static int
+is_numeric_array(Scanner *scanner, ScanContainer *container)
+{
+    Tape *tape = scanner->tape;
+    Py_ssize_t i;
+    int type;
+
+    if (*container->start != '[' || container->count == 0 ||
+        tape->size - container->first != container->count)
+        return False;
+    for (i = container->first; i < tape->size; i++) {
+        type = tape->entries[i].type;
+        if (type != TapeInteger && type != TapeFloat && type != TapeNumber)
+            return False;
+    }
+    return True;
+}
+
+
+// Close the innermost array or object, recording it on the tape. Arrays of
+// numbers are recorded ahead of their items, so they can be built without
+// making an object for each item
+static int
+scan_close_container(Scanner *scanner, Py_ssize_t depth)
+{
+    ScanContainer *container = &scanner->containers[depth-1];
+    TapeEntry *entry;
+
+    if (scanner->tape != NULL && scanner->numeric_arrays &&
+        is_numeric_array(scanner, container)) {
+        if (tape_add(scanner, TapeNumericArray) == NULL)
+            return -1;
+        entry = scanner->tape->entries + container->first;
+        memmove(entry + 1, entry, container->count * sizeof(TapeEntry));
+        entry->type = TapeNumericArray;
+        entry->length = container->count;
+    } else if (scanner->tape != NULL) {
+        entry = tape_add(scanner, *container->start=='[' ? TapeArray : TapeObject);
+        if (entry == NULL)
+            return -1;
+        entry->length = container->count;
+    }
+    return 0;
+}
+
+
+/*
+ * Check that the input is a single well-formed JSON value. Returns 0 if it is
+ * and -1 with the error recorded in the scanner otherwise.
+ */
+static int
+scan_document(Scanner *scanner)
+{
+    ScanContainer initial[CONTAINER_STACK_INITIAL_SIZE];
+    Py_ssize_t depth;
+    char *start;
+    int c, result;
+
+    scanner->containers = initial;
+    scanner->allocated = CONTAINER_STACK_INITIAL_SIZE;
+    scanner->error = NoError;
+    scanner->error_ptr = NULL;
+    depth = 0;
+
+scan_value:
+    scanSpaces(scanner);
+    if (scanner->ptr == scanner->end) {
+        if (depth == 0) {
+            result = scan_error(scanner, EmptyDescription, scanner->ptr);
+            goto done;
+        }
+        goto unterminated;
+    }
+    switch (*scanner->ptr) {
+    case '[':
+    case '{':
+        c = *scanner->ptr;
+        if (scan_open_container(scanner, depth++) == -1)
+            goto failure;
+        scanSpaces(scanner);
+        if (scanner->ptr < scanner->end && *scanner->ptr == (c=='[' ? ']' : '}')) {
+            scanner->ptr++;
+            if (scan_close_container(scanner, depth--) == -1)
+                goto failure;
+            goto value_done;
+        }
+        if (c == '[')
+            goto array_item;
+        goto object_key;
+    case '"':
+        result = scan_string_value(scanner);
+        break;
+    case 't':
+        result = scan_literal(scanner, "true", 4, TapeTrue);
+        break;
+    case 'f':
+        result = scan_literal(scanner, "false", 5, TapeFalse);
+        break;
+    case 'n':
+        result = scan_literal(scanner, "null", 4, TapeNull);
+        break;
+    case 'N':
+        result = scan_literal(scanner, "NaN", 3, TapeFloat);
+        break;
+    case 'I':
+        result = scan_literal(scanner, "Infinity", 8, TapeFloat);
+        break;
+    case '+':
+    case '-':
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+        result = scan_number(scanner);
+        break;
+    default:
+        result = scan_error(scanner, CannotParse, scanner->ptr);
+        break;
+    }
+    if (result == -1)
+        goto failure;
+
+value_done:
+    scanSpaces(scanner);
+    if (depth == 0) {
+        if (scanner->ptr < scanner->end && !scanner->single_value) {
+            result = scan_error(scanner, ExtraData, scanner->ptr);
+            goto done;
+        }
+        result = 0;
+        goto done;
+    }
+    scanner->containers[depth-1].count++;
+    if (scanner->ptr == scanner->end)
+        goto unterminated;
+    start = scanner->containers[depth-1].start;
+    c = *scanner->ptr++;
+    if (c == (*start=='[' ? ']' : '}')) {
+        if (scan_close_container(scanner, depth--) == -1)
+            goto failure;
+        goto value_done;
+    } else if (c == ',') {
+        if (*start == '[')
+            goto array_item;
+        goto object_key;
+    }
+    result = scan_error(scanner, *start=='[' ? ExpectingArrayComma : ExpectingObjectComma,
+                        scanner->ptr-1);
+    goto done;
+
+array_item:
+    scanSpaces(scanner);
+    if (scanner->ptr == scanner->end)
+        goto unterminated;
+    if (*scanner->ptr==',' || *scanner->ptr==']') {
+        result = scan_error(scanner, ExpectingArrayItem, scanner->ptr);
+        goto done;
+    }
+    goto scan_value;
+
+object_key:
+    scanSpaces(scanner);
+    if (scanner->ptr == scanner->end)
+        goto unterminated;
+    if (*scanner->ptr != '"') {
+        result = scan_error(scanner, ExpectingPropertyName, scanner->ptr);
+        goto done;
+    }
+    if (scan_string_value(scanner) == -1)
+        goto failure;
+    scanSpaces(scanner);
+    if (scanner->ptr == scanner->end)
+        goto unterminated;
+    if (*scanner->ptr != ':') {
+        result = scan_error(scanner, MissingColon, scanner->ptr);
+        goto done;
+    }
+    scanner->ptr++;
+    scanSpaces(scanner);
+    if (scanner->ptr == scanner->end)
+        goto unterminated;
+    if (*scanner->ptr==',' || *scanner->ptr=='}') {
+        result = scan_error(scanner, ExpectingPropertyValue, scanner->ptr);
+        goto done;
+    }
+    goto scan_value;
+
+unterminated:
+    start = scanner->containers[depth-1].start;
+    result = scan_error(scanner, *start=='[' ? UnterminatedArray : UnterminatedObject, start);
+    goto done;
+
+failure:
+    result = -1;
+
+done:
+    if (scanner->containers != initial)
+        free(scanner->containers);
+    scanner->containers = NULL;
+    return result;
+}
+
+
+// Build the number recorded on a tape entry
+static PyObject*
+build_number(JSONData *jsondata, TapeEntry *entry)
+{
+    switch (entry->type) {
+    case TapeInteger:
+        if (entry->value.integer >= LONG_MIN && entry->value.integer <= LONG_MAX)
+            return PyInt_FromLong((long)entry->value.integer);
+        return PyLong_FromLongLong(entry->value.integer);
+    case TapeFloat:
+        return PyFloat_FromDouble(entry->value.real);
+    default:
+        jsondata->ptr = entry->value.ptr;
+        return decode_number(jsondata);
+    }
+}
+
+
+// Get the array.array type code that holds the numbers on the tape entries
+static char
+numbers_typecode(TapeEntry *entries, Py_ssize_t n)
+{
+    Py_ssize_t i, j;
+    char c;
+
+    for (i = 0; i < n; i++) {
+        if (entries[i].type == TapeFloat)
+            return 'd';
+        if (entries[i].type != TapeNumber)
+            continue;
+        for (j = 0; j < entries[i].length; j++) {
+            c = entries[i].value.ptr[j];
+            if (c == '.' || c == 'e' || c == 'E')
+                return 'd';
+        }
+    }
+    return 'l';
+}
+
+
+/*
+ * Store the numbers on the tape entries into output as machine values of the
+ * given type code, 'l' or 'd'. Returns 0 on success, 1 if some number cannot
+ * be stored exactly and -1 with an exception set on error.
+ */
+static int
+store_numbers(JSONData *jsondata, TapeEntry *entries, Py_ssize_t n,
+              char typecode, void *output)
+{
+    long *integers = output;
+    double *reals = output;
+    PY_LONG_LONG integer;
+    PyObject *object;
+    Py_ssize_t i;
+
+    for (i = 0; i < n; i++) {
+        switch (entries[i].type) {
+        case TapeInteger:
+            integer = entries[i].value.integer;
+            break;
+        case TapeFloat:
+            if (typecode != 'd')
+                return 1;
+            reals[i] = entries[i].value.real;
+            continue;
+        default:
+            object = build_number(jsondata, &entries[i]);
+            if (object == NULL)
+                return -1;
+            if (PyFloat_CheckExact(object) && typecode == 'd') {
+                reals[i] = PyFloat_AS_DOUBLE(object);
+                Py_DECREF(object);
+                continue;
+            } else if (!PyInt_CheckExact(object)) {
+                Py_DECREF(object);
+                return 1;
+            }
+            integer = PyInt_AS_LONG(object);
+            Py_DECREF(object);
+            break;
+        }
+        if (typecode == 'd') {
+            if (integer > MAX_EXACT_DOUBLE_INTEGER || integer < -MAX_EXACT_DOUBLE_INTEGER)
+                return 1;
+            reals[i] = (double)integer;
+        } else {
+            if (integer < LONG_MIN || integer > LONG_MAX)
+                return 1;
+            integers[i] = (long)integer;
+        }
+    }
+    return 0;
+}
+
+
+// Build the array of numbers on the tape entries without making objects for
+// them, unless they do not fit in an array.array
+static PyObject*
+build_numeric_array(JSONData *jsondata, TapeEntry *entries, Py_ssize_t n)
+{
+    ObjectStack *stack = &jsondata->stack;
+    PyObject *object = NULL;
+    Py_ssize_t i, base, itemsize;
+    char typecode[2];
+    void *values;
+    int result;
+
+    typecode[0] = numbers_typecode(entries, n);
+    typecode[1] = 0;
+    itemsize = typecode[0]=='d' ? sizeof(double) : sizeof(long);
+    values = PyMem_Malloc(n * itemsize);
+    if (values == NULL)
+        return PyErr_NoMemory();
+    result = store_numbers(jsondata, entries, n, typecode[0], values);
+    if (result == 0)
+        object = make_typed_array(typecode, values, n * itemsize);
+    PyMem_Free(values);
+    if (result == 0)
+        return object;
+    else if (result == -1)
+        return NULL;
+
+    base = stack->size;
+    for (i = 0; i < n; i++) {
+        object = build_number(jsondata, &entries[i]);
+        if (object == NULL || stack_push(stack, object) == -1) {
+            stack_pop_to(stack, base);
+            return NULL;
+        }
+    }
+    return make_array(jsondata, base);
+}
+
+
+// Scan the input, releasing the GIL while doing it if the input is large
+static int
+scan_input(Scanner *scanner)
+{
+    int result;
+
+    if (scanner->end - scanner->ptr < SCAN_RELEASE_GIL_SIZE)
+        return scan_document(scanner);
+
+    Py_BEGIN_ALLOW_THREADS
+    result = scan_document(scanner);
+    Py_END_ALLOW_THREADS
+
+    return result;
+}
+
+
+/*
+ * Raise the DecodeError for the error found by the scanner, with the same
+ * message decode_json gives for it. Only strings are decoded again, to tell
+ * why the python codec rejects them: the one the scanner found invalid and
+ * the ones recorded before the error that it left for the codec to check,
+ * as decode_json would have stopped at the first of them that is invalid.
+ */
+static void
+raise_scan_error(JSONData *jsondata, Scanner *scanner)
+{
+    Py_ssize_t pos = position(jsondata, scanner->error_ptr);
+    PyObject *object;
+    Py_ssize_t i;
+
+    if (scanner->tape != NULL && scanner->error != OutOfMemory) {
+        for (i = 0; i < scanner->tape->size; i++) {
+            if (scanner->tape->entries[i].type != TapeRawString)
+                continue;
+            jsondata->ptr = scanner->tape->entries[i].value.ptr;
+            object = decode_string(jsondata);
+            if (object == NULL)
+                return;
+            Py_DECREF(object);
+        }
+    }
+
+    switch (scanner->error) {
+    case EmptyDescription:
+        raise_decode_error(jsondata, pos, "empty JSON description");
+        break;
+    case CannotParse:
+        jsondata->ptr = scanner->error_ptr;
+        if (strchr("tfnNI+-", *jsondata->ptr) != NULL)
+            raise_parse_error(jsondata);
+        else
+            raise_decode_error(jsondata, pos, "cannot parse JSON description");
+        break;
+    case InvalidNumber:
+        raise_decode_error(jsondata, pos, "invalid number starting at position " SSIZE_T_F, pos);
+        break;
+    case InvalidString:
+        jsondata->ptr = scanner->error_ptr;
+        object = decode_string(jsondata);
+        if (object != NULL) {
+            Py_DECREF(object);
+            raise_decode_error(jsondata, pos, "invalid string starting at position " SSIZE_T_F, pos);
+        }
+        break;
+    case UnterminatedString:
+        raise_decode_error(jsondata, pos, "unterminated string starting at position " SSIZE_T_F, pos);
+        break;
+    case UnterminatedArray:
+        raise_decode_error(jsondata, pos, "unterminated array starting at position " SSIZE_T_F, pos);
+        break;
+    case UnterminatedObject:
+        raise_decode_error(jsondata, pos, "unterminated object starting at position " SSIZE_T_F, pos);
+        break;
+    case ExpectingArrayItem:
+        raise_decode_error(jsondata, pos, "expecting array item at position " SSIZE_T_F, pos);
+        break;
+    case ExpectingArrayComma:
+        raise_decode_error(jsondata, pos, "expecting ',' or ']' at position " SSIZE_T_F, pos);
+        break;
+    case ExpectingPropertyName:
+        raise_decode_error(jsondata, pos, "expecting object property name at position " SSIZE_T_F, pos);
+        break;
+    case MissingColon:
+        raise_decode_error(jsondata, pos, "missing colon after object property name"
+                           " at position " SSIZE_T_F, pos);
+        break;
+    case ExpectingPropertyValue:
+        raise_decode_error(jsondata, pos, "expecting object property value at position " SSIZE_T_F, pos);
+        break;
+    case ExpectingObjectComma:
+        raise_decode_error(jsondata, pos, "expecting ',' or '}' at position " SSIZE_T_F, pos);
+        break;
+    case MaxDepthExceeded:
+        raise_decode_error(jsondata, pos, "maximum nesting depth of " SSIZE_T_F
+                           " exceeded at position " SSIZE_T_F, jsondata->max_depth, pos);
+        break;
+    case ExtraData:
+        raise_decode_error(jsondata, pos, "extra data after JSON description"
+                           " at position " SSIZE_T_F, pos);
+        break;
+    default:
+        PyErr_NoMemory();
+        break;
+    }
+}
+
+
+/*
+ * Skip over the JSON value at the current position without decoding it, but
+ * checking it like decode does, with a scanner that does not record it.
+ * Returns 0 on success and -1 with an exception set on error.
+ */
+static int
+scan_skip_value(JSONData *jsondata)
+{
+    Scanner scanner;
+
+    scanner.str = jsondata->str;
+    scanner.ptr = jsondata->ptr;
+    scanner.end = jsondata->end;
+    // the value is nested in the containers being decoded
+    scanner.max_depth = jsondata->max_depth - jsondata->containers.size;
+    scanner.tape = NULL;
+    scanner.float_spans = scanner.integer_spans = False;
+    scanner.numeric_arrays = False;
+    scanner.single_value = True;
+
+    if (scan_document(&scanner) == -1) {
+        raise_scan_error(jsondata, &scanner);
+        return -1;
+    }
+    jsondata->ptr = scanner.ptr;
+
+    return 0;
+}
+
+
+/*
+ * Build the value recorded on the tape entries from first up to last. The
+ * values are pushed on the object stack as they come and every array or object
+ * entry collects the members that precede it, the same way decode_json does.
+ */
+static PyObject*
+build_tape(JSONData *jsondata, Tape *tape, Py_ssize_t first, Py_ssize_t last)
+{
+    ObjectStack *stack = &jsondata->stack;
+    TapeEntry *entry, *end;
+    PyObject *object;
+
+    end = tape->entries + last;
+
+    for (entry = tape->entries + first; entry < end; entry++) {
+        switch (entry->type) {
+        case TapeNull:
+            Py_INCREF(Py_None);
+            object = Py_None;
+            break;
+        case TapeTrue:
+            Py_INCREF(Py_True);
+            object = Py_True;
+            break;
+        case TapeFalse:
+            Py_INCREF(Py_False);
+            object = Py_False;
+            break;
+        case TapeInteger:
+        case TapeFloat:
+        case TapeNumber:
+            object = build_number(jsondata, entry);
+            break;
+        case TapeString:
+            if (jsondata->all_unicode)
+                object = PyUnicode_DecodeUnicodeEscape(entry->value.ptr, entry->length, NULL);
+            else
+                object = PyString_FromStringAndSize(entry->value.ptr, entry->length);
+            break;
+        case TapeEscapedString:
+            if (jsondata->all_unicode)
+                object = PyUnicode_DecodeLatin1(tape->strings + entry->value.offset, entry->length, NULL);
+            else
+                object = PyString_FromStringAndSize(tape->strings + entry->value.offset, entry->length);
+            break;
+        case TapeRawString:
+            jsondata->ptr = entry->value.ptr;
+            object = decode_string(jsondata);
+            break;
+        case TapeArray:
+            object = make_array(jsondata, stack->size - entry->length);
+            break;
+        case TapeNumericArray:
+            object = build_numeric_array(jsondata, entry + 1, entry->length);
+            entry += entry->length;
+            break;
+        default:
+            object = make_object(jsondata, stack->size - 2*entry->length);
+            break;
+        }
+        if (object == NULL || stack_push(stack, object) == -1) {
+            stack_pop_to(stack, 0);
+            return NULL;
+        }
+    }
+
+    // a complete value leaves a single object on the stack
+    if (stack->size != 1) {
+        stack_pop_to(stack, 0);
+        PyErr_SetString(PyExc_SystemError, "unbalanced tape left on the object stack");
+        return NULL;
+    }
+    stack->size = 0;
+    return stack->items[0];
+}
+
+
+/*
+ * Decode the JSON value that makes up the whole input in two phases. First the
+ * input is scanned into a tape, with the GIL released if it is large, then the
+ * objects are built from the tape while holding it. Invalid input raises the
+ * error found by the scanner.
+ */
+static PyObject*
+decode_document_tape(JSONData *jsondata)
+{
+    PyObject *object;
+    Scanner scanner;
+    Tape tape;
+    int result;
+
+    tape_init(&tape);
+    scanner.str = scanner.ptr = jsondata->ptr;
+    scanner.end = jsondata->end;
+    scanner.max_depth = jsondata->max_depth;
+    scanner.tape = &tape;
+    scanner.float_spans = (jsondata->decimal_type != NULL || jsondata->raw_numbers);
+    scanner.integer_spans = jsondata->raw_numbers;
+    scanner.numeric_arrays = jsondata->numeric_arrays;
+    scanner.single_value = False;
+
+    result = scan_input(&scanner);
+
+    if (result == 0) {
+        object = build_tape(jsondata, &tape, 0, tape.size);
+    } else {
+        raise_scan_error(jsondata, &scanner);
+        object = NULL;
+    }
+
+    tape_free(&tape);
+
+    return object;
+}
+
+
+/* ---------------------------- Raw numbers ---------------------------- */
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *text; // the number as it appears in the JSON representation
+} RawNumber;
+
+
+// Make a RawNumber from a string that is already known to be a valid number
+static PyObject*
+make_raw_number(PyObject *text)
+{
+    RawNumber *self;
+
+    self = PyObject_New(RawNumber, &RawNumber_Type);
+    if (self == NULL)
+        return NULL;
+    Py_INCREF(text);
+    self->text = text;
+
+    return (PyObject*)self;
+}
+
+
+static PyObject*
+RawNumber_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"text", NULL};
+    PyObject *text;
+    RawNumber *self;
+    Scanner scanner;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "S:RawNumber", kwlist, &text))
+        return NULL;
+
+    scanner.str = scanner.ptr = PyString_AS_STRING(text);
+    scanner.end = scanner.str + PyString_GET_SIZE(text);
+    scanner.tape = NULL;
+    if (scanner.ptr == scanner.end || *scanner.ptr == 'I' ||
+        (scanner.end - scanner.ptr > 1 && scanner.ptr[1] == 'I') ||
+        scan_number(&scanner) == -1 || scanner.ptr != scanner.end) {
+        PyErr_Format(PyExc_ValueError, "invalid JSON number: %.200s", PyString_AS_STRING(text));
+        return NULL;
+    }
+
+    self = (RawNumber*)type->tp_alloc(type, 0);
+    if (self == NULL)
+        return NULL;
+    Py_INCREF(text);
+    self->text = text;
+
+    return (PyObject*)self;
+}
+
+
+static void
+RawNumber_dealloc(RawNumber *self)
+{
+    Py_XDECREF(self->text);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+
+static PyObject*
+RawNumber_str(RawNumber *self)
+{
+    Py_INCREF(self->text);
+    return self->text;
+}
+
+
+static PyObject*
+RawNumber_repr(RawNumber *self)
+{
+    return PyString_FromFormat("RawNumber('%s')", PyString_AS_STRING(self->text));
+}
+
+
+static long
+RawNumber_hash(RawNumber *self)
+{
+    return PyObject_Hash(self->text);
+}
+
+
+// Raw numbers are equal when their text is the same
+static PyObject*
+RawNumber_richcompare(PyObject *a, PyObject *b, int op)
+{
+    if ((op != Py_EQ && op != Py_NE) ||
+        !PyObject_TypeCheck(a, &RawNumber_Type) || !PyObject_TypeCheck(b, &RawNumber_Type)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+    return PyObject_RichCompare(((RawNumber*)a)->text, ((RawNumber*)b)->text, op);
+}
+
+
+static PyObject*
+RawNumber_int(RawNumber *self)
+{
+    PyObject *number, *result;
+
+    if (strpbrk(PyString_AS_STRING(self->text), ".eE") == NULL)
+        return PyNumber_Int(self->text);
+    number = PyFloat_FromString(self->text, NULL);
+    if (number == NULL)
+        return NULL;
+    result = PyNumber_Int(number);
+    Py_DECREF(number);
+    return result;
+}
+
+
+static PyObject*
+RawNumber_long(RawNumber *self)
+{
+    PyObject *number, *result;
+
+    number = RawNumber_int(self);
+    if (number == NULL)
+        return NULL;
+    result = PyNumber_Long(number);
+    Py_DECREF(number);
+    return result;
+}
+
+
+static PyObject*
+RawNumber_float(RawNumber *self)
+{
+    return PyFloat_FromString(self->text, NULL);
+}
+
+
+static PyNumberMethods RawNumber_as_number = {
+    0,                                          // nb_add
+    0,                                          // nb_subtract
+    0,                                          // nb_multiply
+    0,                                          // nb_divide
+    0,                                          // nb_remainder
+    0,                                          // nb_divmod
+    0,                                          // nb_power
+    0,                                          // nb_negative
+    0,                                          // nb_positive
+    0,                                          // nb_absolute
+    0,                                          // nb_nonzero
+    0,                                          // nb_invert
+    0,                                          // nb_lshift
+    0,                                          // nb_rshift
+    0,                                          // nb_and
+    0,                                          // nb_xor
+    0,                                          // nb_or
+    0,                                          // nb_coerce
+    (unaryfunc)RawNumber_int,                   // nb_int
+    (unaryfunc)RawNumber_long,                  // nb_long
+    (unaryfunc)RawNumber_float,                 // nb_float
+};
+
+PyDoc_STRVAR(RawNumber_doc,
+"RawNumber(text) -> a JSON number kept as the text it was written with.\n"
+"\n"
+"Returned by decode when raw_numbers is True and written verbatim by encode,\n"
+"so numbers pass through a decode/encode round trip unchanged. Use int() or\n"
+"float() to get its value."
+);
+
+static PyTypeObject RawNumber_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cjson.RawNumber",                          // tp_name
+    sizeof(RawNumber),                          // tp_basicsize
+    0,                                          // tp_itemsize
+    (destructor)RawNumber_dealloc,              // tp_dealloc
+    0,                                          // tp_print
+    0,                                          // tp_getattr
+    0,                                          // tp_setattr
+    0,                                          // tp_compare
+    (reprfunc)RawNumber_repr,                   // tp_repr
+    &RawNumber_as_number,                       // tp_as_number
+    0,                                          // tp_as_sequence
+    0,                                          // tp_as_mapping
+    (hashfunc)RawNumber_hash,                   // tp_hash
+    0,                                          // tp_call
+    (reprfunc)RawNumber_str,                    // tp_str
+    0,                                          // tp_getattro
+    0,                                          // tp_setattro
+    0,                                          // tp_as_buffer
+    Py_TPFLAGS_DEFAULT,                         // tp_flags
+    RawNumber_doc,                              // tp_doc
+    0,                                          // tp_traverse
+    0,                                          // tp_clear
+    RawNumber_richcompare,                      // tp_richcompare
+    0,                                          // tp_weaklistoffset
+    0,                                          // tp_iter
+    0,                                          // tp_iternext
+    0,                                          // tp_methods
+    0,                                          // tp_members
+    0,                                          // tp_getset
+    0,                                          // tp_base
+    0,                                          // tp_dict
+    0,                                          // tp_descr_get
+    0,                                          // tp_descr_set
+    0,                                          // tp_dictoffset
+    0,                                          // tp_init
+    0,                                          // tp_alloc
+    RawNumber_new,                              // tp_new
+};
+
+
+/* ------------------------- Raw JSON fragments ------------------------ */
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *text; // the encoded JSON fragment
+} RawJSON;
+
+
+static PyObject*
+RawJSON_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"text", "validate", NULL};
+    int validate = False;
+    PyObject *text;
+    RawJSON *self;
+    JSONData jsondata;
+    Scanner scanner;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "S|i:RawJSON", kwlist, &text, &validate))
+        return NULL;
+
+    if (validate) {
+        scanner.str = scanner.ptr = PyString_AS_STRING(text);
+        scanner.end = scanner.str + PyString_GET_SIZE(text);
+        scanner.max_depth = DEFAULT_MAX_DEPTH;
+        scanner.tape = NULL;
+        scanner.single_value = False;
+        if (scan_document(&scanner) == -1) {
+            // raise the error found by the scanner, for the fragment as input
+            jsondata_init(&jsondata, False, DEFAULT_MAX_DEPTH);
+            jsondata.str = jsondata.ptr = scanner.str;
+            jsondata.end = scanner.end;
+            jsondata.owner = text;
+            raise_scan_error(&jsondata, &scanner);
+            jsondata_free(&jsondata);
+            return NULL;
+        }
+    }
+
+    self = (RawJSON*)type->tp_alloc(type, 0);
+    if (self == NULL)
+        return NULL;
+    Py_INCREF(text);
+    self->text = text;
+
+    return (PyObject*)self;
+}
+
+
+static void
+RawJSON_dealloc(RawJSON *self)
+{
+    Py_XDECREF(self->text);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+
+static PyObject*
+RawJSON_str(RawJSON *self)
+{
+    Py_INCREF(self->text);
+    return self->text;
+}
+
+
+static PyObject*
+RawJSON_repr(RawJSON *self)
+{
+    PyObject *text, *result;
+
+    text = PyObject_Repr(self->text);
+    if (text == NULL)
+        return NULL;
+    result = PyString_FromFormat("RawJSON(%s)", PyString_AS_STRING(text));
+    Py_DECREF(text);
+
+    return result;
+}
+
+
+static long
+RawJSON_hash(RawJSON *self)
+{
+    return PyObject_Hash(self->text);
+}
+
+
+// Raw JSON fragments are equal when their text is the same
+static PyObject*
+RawJSON_richcompare(PyObject *a, PyObject *b, int op)
+{
+    if ((op != Py_EQ && op != Py_NE) ||
+        !PyObject_TypeCheck(a, &RawJSON_Type) || !PyObject_TypeCheck(b, &RawJSON_Type)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+    return PyObject_RichCompare(((RawJSON*)a)->text, ((RawJSON*)b)->text, op);
+}
+
+
+PyDoc_STRVAR(RawJSON_doc,
+"RawJSON(text, validate=False) -> a pre-encoded JSON fragment.\n"
+"\n"
+"encode copies the text of a RawJSON into its output as is, instead of\n"
+"encoding it as a string. This way cached JSON representations can be\n"
+"embedded in larger documents without decoding and encoding them again.\n"
+"If validate is True the text is checked to be a single well-formed JSON\n"
+"value and a DecodeError is raised if it is not."
+);
+
+static PyTypeObject RawJSON_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cjson.RawJSON",                            // tp_name
+    sizeof(RawJSON),                            // tp_basicsize
+    0,                                          // tp_itemsize
+    (destructor)RawJSON_dealloc,                // tp_dealloc
+    0,                                          // tp_print
+    0,                                          // tp_getattr
+    0,                                          // tp_setattr
+    0,                                          // tp_compare
+    (reprfunc)RawJSON_repr,                     // tp_repr
+    0,                                          // tp_as_number
+    0,                                          // tp_as_sequence
+    0,                                          // tp_as_mapping
+    (hashfunc)RawJSON_hash,                     // tp_hash
+    0,                                          // tp_call
+    (reprfunc)RawJSON_str,                      // tp_str
+    0,                                          // tp_getattro
+    0,                                          // tp_setattro
+    0,                                          // tp_as_buffer
+    Py_TPFLAGS_DEFAULT,                         // tp_flags
+    RawJSON_doc,                                // tp_doc
+    0,                                          // tp_traverse
+    0,                                          // tp_clear
+    RawJSON_richcompare,                        // tp_richcompare
+    0,                                          // tp_weaklistoffset
+    0,                                          // tp_iter
+    0,                                          // tp_iternext
+    0,                                          // tp_methods
+    0,                                          // tp_members
+    0,                                          // tp_getset
+    0,                                          // tp_base
+    0,                                          // tp_dict
+    0,                                          // tp_descr_get
+    0,                                          // tp_descr_set
+    0,                                          // tp_dictoffset
+    0,                                          // tp_init
+    0,                                          // tp_alloc
+    RawJSON_new,                                // tp_new
+};
+
+
+/* ------------------------------ Encoding ----------------------------- */
+
+/*
+ * This function is an almost verbatim copy of PyString_Repr() from
+ * Python's stringobject.c with the following differences:
+ *
+ * - it always quotes the output using double quotes.
+ * - it also quotes \b and \f
+ * - it replaces any non ASCII character hh with \u00hh instead of \xhh
+ */
+static PyObject*
+encode_string(PyObject *string)
+{
+    register PyStringObject* op = (PyStringObject*) string;
+    size_t newsize = 2 + 6 * op->ob_size;
+    PyObject *v;
+
+    if (op->ob_size > (PY_SSIZE_T_MAX-2)/6) {
+        PyErr_SetString(PyExc_OverflowError,
+                        "string is too large to make repr");
+        return NULL;
+    }
+    v = PyString_FromStringAndSize((char *)NULL, newsize);
+    if (v == NULL) {
+        return NULL;
+    }
+    else {
+        register Py_ssize_t i;
+        register char c;
+        register char *p;
+        int quote;
+
+        quote = '"';
+
+        p = PyString_AS_STRING(v);
+        *p++ = quote;
+        for (i = 0; i < op->ob_size; i++) {
+            /* There's at least enough room for a hex escape
+             and a closing quote. */
+            assert(newsize - (p - PyString_AS_STRING(v)) >= 7);
+            c = op->ob_sval[i];
+            if (c == quote || c == '\\')
                 *p++ = '\\', *p++ = c;
             else if (c == '\t')
                 *p++ = '\\', *p++ = 't';
@@ -637,522 +3154,4391 @@ encode_string(PyObject *string)
                 sprintf(p, "\\u%04x", c & 0xff);
                 p += 6;
             }
-            else
-                *p++ = c;
+            else
+                *p++ = c;
+        }
+        assert(newsize - (p - PyString_AS_STRING(v)) >= 1);
+        *p++ = quote;
+        *p = '\0';
+        _PyString_Resize(&v, (int) (p - PyString_AS_STRING(v)));
+        return v;
+    }
+}
+
+/*
+ * This function is an almost verbatim copy of unicodeescape_string() from
+ * Python's unicodeobject.c with the following differences:
+ *
+ * - it always quotes the output using double quotes.
+ * - it uses \u00hh instead of \xhh in output.
+ * - it also quotes \b and \f
+ */
+static PyObject*
+encode_unicode(PyObject *unicode)
+{
+    PyObject *repr;
+    Py_UNICODE *s;
+    Py_ssize_t size;
+    char *p;
+
+    static const char *hexdigit = "0123456789abcdef";
+#ifdef Py_UNICODE_WIDE
+    const Py_ssize_t expandsize = 12;
+#else
+    const Py_ssize_t expandsize = 6;
+#endif
+
+    /* Initial allocation is based on the longest-possible unichr
+       escape.
+
+       In wide (UTF-32) builds '\U00xxxxxx' is 10 chars per source
+       unichr, so in this case it's the longest unichr escape. In
+       narrow (UTF-16) builds this is five chars per source unichr
+       since there are two unichrs in the surrogate pair, so in narrow
+       (UTF-16) builds it's not the longest unichr escape.
+
+       In wide or narrow builds '\uxxxx' is 6 chars per source unichr,
+       so in the narrow (UTF-16) build case it's the longest unichr
+       escape.
+    */
+
+    s = PyUnicode_AS_UNICODE(unicode);
+    size = PyUnicode_GET_SIZE(unicode);
+
+    if (size > (PY_SSIZE_T_MAX-2-1)/expandsize) {
+        PyErr_SetString(PyExc_OverflowError,
+                        "unicode object is too large to make repr");
+        return NULL;
+    }
+
+    repr = PyString_FromStringAndSize(NULL, 2 + expandsize*size + 1);
+    if (repr == NULL)
+        return NULL;
+
+    p = PyString_AS_STRING(repr);
+
+    *p++ = '"';
+
+    while (size-- > 0) {
+        Py_UNICODE ch = *s++;
+
+        /* Escape quotes */
+        if ((ch == (Py_UNICODE) PyString_AS_STRING(repr)[0] || ch == '\\')) {
+            *p++ = '\\';
+            *p++ = (char) ch;
+            continue;
+        }
+
+#ifdef Py_UNICODE_WIDE
+        /* Map 21-bit characters to UTF-16 surrogate pairs */
+        else if (ch >= 0x10000) {
+            unsigned short ucs1, ucs2;
+            ucs1 = (unsigned short)(((ch - 0x10000) >> 10) & 0x03FF) + 0xD800;
+            ucs2 = (unsigned short)((ch - 0x10000) & 0x03FF) + 0xDC00;
+
+            *p++ = '\\';
+            *p++ = 'u';
+            *p++ = hexdigit[(ucs1 >> 12) & 0x000F];
+            *p++ = hexdigit[(ucs1 >> 8) & 0x000F];
+            *p++ = hexdigit[(ucs1 >> 4) & 0x000F];
+            *p++ = hexdigit[ucs1 & 0x000F];
+            *p++ = '\\';
+            *p++ = 'u';
+            *p++ = hexdigit[(ucs2 >> 12) & 0x000F];
+            *p++ = hexdigit[(ucs2 >> 8) & 0x000F];
+            *p++ = hexdigit[(ucs2 >> 4) & 0x000F];
+            *p++ = hexdigit[ucs2 & 0x000F];
+            continue;
+        }
+#endif
+
+        /* Map 16-bit characters to '\uxxxx' */
+        if (ch >= 256) {
+            *p++ = '\\';
+            *p++ = 'u';
+            *p++ = hexdigit[(ch >> 12) & 0x000F];
+            *p++ = hexdigit[(ch >> 8) & 0x000F];
+            *p++ = hexdigit[(ch >> 4) & 0x000F];
+            *p++ = hexdigit[ch & 0x000F];
+        }
+
+        /* Map special whitespace to '\t', \n', '\r', '\f', '\b' */
+        else if (ch == '\t') {
+            *p++ = '\\';
+            *p++ = 't';
+        }
+        else if (ch == '\n') {
+            *p++ = '\\';
+            *p++ = 'n';
+        }
+        else if (ch == '\r') {
+            *p++ = '\\';
+            *p++ = 'r';
+        }
+        else if (ch == '\f') {
+            *p++ = '\\';
+            *p++ = 'f';
+        }
+        else if (ch == '\b') {
+            *p++ = '\\';
+            *p++ = 'b';
+        }
+
+        /* Map non-printable US ASCII to '\u00hh' */
+        else if (ch < ' ' || ch >= 0x7F) {
+            *p++ = '\\';
+            *p++ = 'u';
+            *p++ = '0';
+            *p++ = '0';
+            *p++ = hexdigit[(ch >> 4) & 0x000F];
+            *p++ = hexdigit[ch & 0x000F];
+        }
+
+        /* Copy everything else as-is */
+        else
+            *p++ = (char) ch;
+    }
+
+    *p++ = PyString_AS_STRING(repr)[0];
+
+    *p = '\0';
+    _PyString_Resize(&repr, p - PyString_AS_STRING(repr));
+    return repr;
+}
+
+
+/*
+ * This function is an almost verbatim copy of tuplerepr() from
+ * Python's tupleobject.c with the following differences:
+ *
+ * - it uses encode_object() to get the object's JSON reprezentation.
+ * - it uses [] as decorations instead of () (to masquerade as a JSON array).
+ */
+
+static PyObject*
+encode_tuple(PyObject *tuple)
+{
+    Py_ssize_t i, n;
+    PyObject *s, *temp;
+    PyObject *pieces, *result = NULL;
+    PyTupleObject *v = (PyTupleObject*) tuple;
+
+    n = v->ob_size;
+    if (n == 0)
+        return PyString_FromString("[]");
+
+    pieces = PyTuple_New(n);
+    if (pieces == NULL)
+        return NULL;
+
+    /* Do repr() on each element. */
+    for (i = 0; i < n; ++i) {
+        s = encode_object(v->ob_item[i]);
+        if (s == NULL)
+            goto Done;
+        PyTuple_SET_ITEM(pieces, i, s);
+    }
+
+    /* Add "[]" decorations to the first and last items. */
+    assert(n > 0);
+    s = PyString_FromString("[");
+    if (s == NULL)
+        goto Done;
+    temp = PyTuple_GET_ITEM(pieces, 0);
+    PyString_ConcatAndDel(&s, temp);
+    PyTuple_SET_ITEM(pieces, 0, s);
+    if (s == NULL)
+        goto Done;
+
+    s = PyString_FromString("]");
+    if (s == NULL)
+        goto Done;
+    temp = PyTuple_GET_ITEM(pieces, n-1);
+    PyString_ConcatAndDel(&temp, s);
+    PyTuple_SET_ITEM(pieces, n-1, temp);
+    if (temp == NULL)
+        goto Done;
+
+    /* Paste them all together with ", " between. */
+    s = PyString_FromString(", ");
+    if (s == NULL)
+        goto Done;
+    result = _PyString_Join(s, pieces);
+    Py_DECREF(s);
+
+Done:
+    Py_DECREF(pieces);
+    return result;
+}
+
+/*
+ * This function is an almost verbatim copy of list_repr() from
+ * Python's listobject.c with the following differences:
+ *
+ * - it uses encode_object() to get the object's JSON reprezentation.
+ * - it doesn't use the ellipsis to represent a list with references
+ *   to itself, instead it raises an exception as such lists cannot be
+ *   represented in JSON.
+ */
+static PyObject*
+encode_list(PyObject *list)
+{
+    Py_ssize_t i;
+    PyObject *s, *temp;
+    PyObject *pieces = NULL, *result = NULL;
+    PyListObject *v = (PyListObject*) list;
+
+    i = Py_ReprEnter((PyObject*)v);
+    if (i != 0) {
+        if (i > 0) {
+            PyErr_SetString(JSON_EncodeError, "a list with references to "
+                            "itself is not JSON encodable");
+        }
+        return NULL;
+    }
+
+    if (v->ob_size == 0) {
+        result = PyString_FromString("[]");
+        goto Done;
+    }
+
+    pieces = PyList_New(0);
+    if (pieces == NULL)
+        goto Done;
+
+    /* Do repr() on each element.  Note that this may mutate the list,
+     * so must refetch the list size on each iteration. */
+    for (i = 0; i < v->ob_size; ++i) {
+        int status;
+        s = encode_object(v->ob_item[i]);
+        if (s == NULL)
+            goto Done;
+        status = PyList_Append(pieces, s);
+        Py_DECREF(s);  /* append created a new ref */
+        if (status < 0)
+            goto Done;
+    }
+
+    /* Add "[]" decorations to the first and last items. */
+    assert(PyList_GET_SIZE(pieces) > 0);
+    s = PyString_FromString("[");
+    if (s == NULL)
+        goto Done;
+    temp = PyList_GET_ITEM(pieces, 0);
+    PyString_ConcatAndDel(&s, temp);
+    PyList_SET_ITEM(pieces, 0, s);
+    if (s == NULL)
+        goto Done;
+
+    s = PyString_FromString("]");
+    if (s == NULL)
+        goto Done;
+    temp = PyList_GET_ITEM(pieces, PyList_GET_SIZE(pieces) - 1);
+    PyString_ConcatAndDel(&temp, s);
+    PyList_SET_ITEM(pieces, PyList_GET_SIZE(pieces) - 1, temp);
+    if (temp == NULL)
+        goto Done;
+
+    /* Paste them all together with ", " between. */
+    s = PyString_FromString(", ");
+    if (s == NULL)
+        goto Done;
+    result = _PyString_Join(s, pieces);
+    Py_DECREF(s);
+
+Done:
+    Py_XDECREF(pieces);
+    Py_ReprLeave((PyObject *)v);
+    return result;
+}
+
+
+/*
+ * This function is an almost verbatim copy of dict_repr() from
+ * Python's dictobject.c with the following differences:
+ *
+ * - it uses encode_object() to get the object's JSON reprezentation.
+ * - only accept strings for keys.
+ * - it doesn't use the ellipsis to represent a dictionary with references
+ *   to itself, instead it raises an exception as such dictionaries cannot
+ *   be represented in JSON.
+ */
+static PyObject*
+encode_dict(PyObject *dict)
+{
+    Py_ssize_t i;
+    PyObject *s, *temp, *colon = NULL;
+    PyObject *pieces = NULL, *result = NULL;
+    PyObject *key, *value;
+    PyDictObject *mp = (PyDictObject*) dict;
+
+    i = Py_ReprEnter((PyObject *)mp);
+    if (i != 0) {
+        if (i > 0) {
+            PyErr_SetString(JSON_EncodeError, "a dict with references to "
+                            "itself is not JSON encodable");
+        }
+        return NULL;
+    }
+
+    if (mp->ma_used == 0) {
+        result = PyString_FromString("{}");
+        goto Done;
+    }
+
+    pieces = PyList_New(0);
+    if (pieces == NULL)
+        goto Done;
+
+    colon = PyString_FromString(": ");
+    if (colon == NULL)
+        goto Done;
+
+    /* Do repr() on each key+value pair, and insert ": " between them.
+     * Note that repr may mutate the dict. */
+    i = 0;
+    while (PyDict_Next((PyObject *)mp, &i, &key, &value)) {
+        int status;
+
+        if (!PyString_Check(key) && !PyUnicode_Check(key)) {
+            PyErr_SetString(JSON_EncodeError, "JSON encodable dictionaries "
+                            "must have string/unicode keys");
+            goto Done;
+        }
+
+        /* Prevent repr from deleting value during key format. */
+        Py_INCREF(value);
+        s = encode_object(key);
+        PyString_Concat(&s, colon);
+        PyString_ConcatAndDel(&s, encode_object(value));
+        Py_DECREF(value);
+        if (s == NULL)
+            goto Done;
+        status = PyList_Append(pieces, s);
+        Py_DECREF(s);  /* append created a new ref */
+        if (status < 0)
+            goto Done;
+    }
+
+    /* Add "{}" decorations to the first and last items. */
+    assert(PyList_GET_SIZE(pieces) > 0);
+    s = PyString_FromString("{");
+    if (s == NULL)
+        goto Done;
+    temp = PyList_GET_ITEM(pieces, 0);
+    PyString_ConcatAndDel(&s, temp);
+    PyList_SET_ITEM(pieces, 0, s);
+    if (s == NULL)
+        goto Done;
+
+    s = PyString_FromString("}");
+    if (s == NULL)
+        goto Done;
+    temp = PyList_GET_ITEM(pieces, PyList_GET_SIZE(pieces) - 1);
+    PyString_ConcatAndDel(&temp, s);
+    PyList_SET_ITEM(pieces, PyList_GET_SIZE(pieces) - 1, temp);
+    if (temp == NULL)
+        goto Done;
+
+    /* Paste them all together with ", " between. */
+    s = PyString_FromString(", ");
+    if (s == NULL)
+        goto Done;
+    result = _PyString_Join(s, pieces);
+    Py_DECREF(s);
+
+Done:
+    Py_XDECREF(pieces);
+    Py_XDECREF(colon);
+    Py_ReprLeave((PyObject *)mp);
+    return result;
+}
+
+
+/*
+ * Encode a decimal.Decimal the same way str() formats it, but directly from
+ * the sign, digits and exponent given by its as_tuple method instead of
+ * calling the python implementation of str(). The special values are encoded
+ * like the corresponding floats.
+ */
+static PyObject*
+encode_decimal(PyObject *object)
+{
+    PyObject *parts, *sign, *digits, *exponent, *digit, *result = NULL;
+    Py_ssize_t n, exp, leftdigits, dotplace, i;
+    char *ptr, *start;
+    long value;
+    int negative;
+
+    parts = PyObject_CallMethod(object, "as_tuple", NULL);
+    if (parts == NULL)
+        return NULL;
+    if (!PyTuple_Check(parts) || PyTuple_GET_SIZE(parts) != 3 ||
+        !PyTuple_Check(PyTuple_GET_ITEM(parts, 1))) {
+        PyErr_SetString(JSON_EncodeError, "object is not JSON encodable");
+        goto done;
+    }
+    sign = PyTuple_GET_ITEM(parts, 0);
+    digits = PyTuple_GET_ITEM(parts, 1);
+    exponent = PyTuple_GET_ITEM(parts, 2);
+
+    negative = PyObject_IsTrue(sign);
+    if (negative == -1)
+        goto done;
+
+    if (PyString_Check(exponent) || PyUnicode_Check(exponent)) {
+        // 'n' and 'N' for the NaNs, 'F' for infinity
+        if (PyString_Check(exponent) && PyString_AS_STRING(exponent)[0] == 'F')
+            result = PyString_FromString(negative ? "-Infinity" : "Infinity");
+        else
+            result = PyString_FromString("NaN");
+        goto done;
+    }
+
+    exp = PyNumber_AsSsize_t(exponent, PyExc_OverflowError);
+    if (exp == -1 && PyErr_Occurred())
+        goto done;
+
+    n = PyTuple_GET_SIZE(digits);
+    if (n == 0) {
+        PyErr_SetString(JSON_EncodeError, "object is not JSON encodable");
+        goto done;
+    }
+    leftdigits = exp + n;
+    if (exp <= 0 && leftdigits > -6)
+        dotplace = leftdigits;
+    else
+        dotplace = 1; // use scientific notation
+
+    // sign, leading zeros, dot, digits and the exponent
+    result = PyString_FromStringAndSize(NULL, 1 + (dotplace < 0 ? 1-dotplace : 1) + 1 + n + 24);
+    if (result == NULL)
+        goto done;
+    start = ptr = PyString_AS_STRING(result);
+
+    if (negative)
+        *ptr++ = '-';
+    if (dotplace <= 0) {
+        *ptr++ = '0';
+        *ptr++ = '.';
+        for (i = dotplace; i < 0; i++)
+            *ptr++ = '0';
+    }
+    // dotplace is never past the digits when it is positive
+    for (i = 0; i < n; i++) {
+        if (i == dotplace && dotplace > 0)
+            *ptr++ = '.';
+        digit = PyTuple_GET_ITEM(digits, i);
+        value = PyInt_Check(digit) ? PyInt_AS_LONG(digit) : -1;
+        if (value < 0 || value > 9) {
+            Py_CLEAR(result);
+            PyErr_SetString(JSON_EncodeError, "object is not JSON encodable");
+            goto done;
+        }
+        *ptr++ = '0' + (char)value;
+    }
+    if (leftdigits != dotplace)
+        ptr += sprintf(ptr, "E%+" PY_FORMAT_SIZE_T "d", leftdigits - dotplace);
+
+    _PyString_Resize(&result, ptr - start);
+
+done:
+    Py_DECREF(parts);
+    return result;
+}
+
+
+// Get the decimal.Decimal type if the decimal module was imported, as no
+// object can be a Decimal before that. Returns NULL otherwise, without an
+// exception set
+static PyObject*
+find_decimal_type(void)
+{
+    PyObject *module;
+
+    if (Decimal_Type == NULL) {
+        module = PyDict_GetItemString(PyImport_GetModuleDict(), "decimal");
+        if (module == NULL)
+            return NULL;
+        Decimal_Type = PyObject_GetAttrString(module, "Decimal");
+        if (Decimal_Type == NULL)
+            PyErr_Clear();
+    }
+    return Decimal_Type;
+}
+
+
+static PyObject*
+encode_object(PyObject *object)
+{
+    if (object == Py_True) {
+        return PyString_FromString("true");
+    } else if (object == Py_False) {
+        return PyString_FromString("false");
+    } else if (object == Py_None) {
+        return PyString_FromString("null");
+    } else if (PyString_Check(object)) {
+        return encode_string(object);
+    } else if (PyUnicode_Check(object)) {
+        return encode_unicode(object);
+    } else if (PyFloat_Check(object)) {
+        double val = PyFloat_AS_DOUBLE(object);
+        if (Py_IS_NAN(val)) {
+            return PyString_FromString("NaN");
+        } else if (Py_IS_INFINITY(val)) {
+            if (val > 0) {
+                return PyString_FromString("Infinity");
+            } else {
+                return PyString_FromString("-Infinity");
+            }
+        } else {
+            return PyObject_Repr(object);
+        }
+    } else if (PyInt_Check(object) || PyLong_Check(object)) {
+        return PyObject_Str(object);
+    } else if (PyObject_TypeCheck(object, &RawNumber_Type)) {
+        return RawNumber_str((RawNumber*)object);
+    } else if (PyObject_TypeCheck(object, &RawJSON_Type)) {
+        return RawJSON_str((RawJSON*)object);
+    } else if (PyList_Check(object)) {
+        PyObject *result;
+        if (Py_EnterRecursiveCall(" while encoding a JSON array from a Python list"))
+            return NULL;
+        result = encode_list(object);
+        Py_LeaveRecursiveCall();
+        return result;
+    } else if (PyTuple_Check(object)) {
+        PyObject *result;
+        if (Py_EnterRecursiveCall(" while encoding a JSON array from a Python tuple"))
+            return NULL;
+        result = encode_tuple(object);
+        Py_LeaveRecursiveCall();
+        return result;
+    } else if (PyDict_Check(object)) { // use PyMapping_Check(object) instead? -Dan
+        PyObject *result;
+        if (Py_EnterRecursiveCall(" while encoding a JSON object"))
+            return NULL;
+        result = encode_dict(object);
+        Py_LeaveRecursiveCall();
+        return result;
+    } else {
+        PyObject *decimal_type;
+        int is_decimal;
+
+        decimal_type = find_decimal_type();
+        if (decimal_type != NULL) {
+            is_decimal = PyObject_IsInstance(object, decimal_type);
+            if (is_decimal == -1)
+                return NULL;
+            if (is_decimal)
+                return encode_decimal(object);
+        }
+        PyErr_SetString(JSON_EncodeError, "object is not JSON encodable");
+        return NULL;
+    }
+}
+
+
+/* Encode object into its JSON representation */
+
+static PyObject*
+JSON_encode(PyObject *self, PyObject *object)
+{
+    return encode_object(object);
+}
+
+
+/*
+ * Point the decoder to the JSON input, which is either a string, a unicode
+ * object or any object that exposes its data as a contiguous buffer (like
+ * bytearray, memoryview and mmap objects). Strings and the new style buffers,
+ * which stay exported while the memoryview holding them is alive, are used in
+ * place. The objects that only have the old buffer interface (like mmap) are
+ * copied into a string, as nothing stops them from being resized or closed by
+ * the hooks or by other threads while the GIL is released, and unicode objects
+ * need to be encoded first.
+ *
+ * Returns a new reference to the object that holds the input data, which must
+ * be kept alive while decoding, or NULL on error.
+ */
+static PyObject*
+jsondata_set_input(JSONData *jsondata, PyObject *json)
+{
+    PyObject *owner;
+    const void *data;
+    Py_ssize_t size;
+
+    if (PyString_Check(json)) {
+        Py_INCREF(json);
+        owner = json;
+        data = PyString_AS_STRING(json);
+        size = PyString_GET_SIZE(json);
+    } else if (PyUnicode_Check(json)) {
+        owner = PyUnicode_AsRawUnicodeEscapeString(json);
+        if (owner == NULL)
+            return NULL;
+        data = PyString_AS_STRING(owner);
+        size = PyString_GET_SIZE(owner);
+    } else if (PyObject_CheckBuffer(json)) {
+        Py_buffer *view;
+
+        // the memoryview holds the exported buffer until it is released
+        owner = PyMemoryView_FromObject(json);
+        if (owner == NULL)
+            return NULL;
+        view = PyMemoryView_GET_BUFFER(owner);
+        if (!PyBuffer_IsContiguous(view, 'C')) {
+            PyErr_SetString(PyExc_TypeError, "the JSON input buffer must be contiguous");
+            Py_DECREF(owner);
+            return NULL;
+        }
+        data = view->buf;
+        size = view->len;
+    } else {
+        if (PyObject_AsReadBuffer(json, &data, &size) == -1)
+            return NULL;
+        owner = PyString_FromStringAndSize(data, size);
+        if (owner == NULL)
+            return NULL;
+        data = PyString_AS_STRING(owner);
+    }
+
+    jsondata->str = jsondata->ptr = (char*)data;
+    jsondata->end = jsondata->str + size;
+    jsondata->owner = owner;
+
+    return owner;
+}
+
+
+/*
+ * Compile the selected key paths, like "id", "user.name" or "items[*].sku",
+ * into a tree of dictionaries. Each dictionary maps the names of the selected
+ * object members to the selection for their values, and None to the selection
+ * for the items of an array. A selection of None means the whole value.
+ */
+static PyObject*
+compile_fields(PyObject *fields)
+{
+    PyObject *root, *iter, *path, *bytes, *parent, *child, *key, *name;
+    char *ptr, *end, *start;
+    int covered, is_unicode;
+
+    root = PyDict_New();
+    if (root == NULL)
+        return NULL;
+
+    iter = PyObject_GetIter(fields);
+    if (iter == NULL) {
+        Py_DECREF(root);
+        return NULL;
+    }
+
+    while ((path = PyIter_Next(iter)) != NULL) {
+        is_unicode = PyUnicode_Check(path);
+        if (is_unicode) {
+            bytes = PyUnicode_AsUTF8String(path);
+        } else if (PyString_Check(path)) {
+            bytes = path;
+            Py_INCREF(bytes);
+        } else {
+            PyErr_Format(PyExc_TypeError, "field paths must be strings, not %.200s",
+                         path->ob_type->tp_name);
+            bytes = NULL;
+        }
+        if (bytes == NULL)
+            goto failure;
+
+        ptr = PyString_AS_STRING(bytes);
+        end = ptr + PyString_GET_SIZE(bytes);
+        parent = root;
+        key = NULL;
+        covered = False;
+
+        while (!covered) {
+            start = ptr;
+            while (ptr < end && *ptr != '.' && *ptr != '[')
+                ptr++;
+            if (ptr > start) {
+                if (is_unicode)
+                    name = PyUnicode_DecodeUTF8(start, ptr - start, NULL);
+                else
+                    name = PyString_FromStringAndSize(start, ptr - start);
+                if (name == NULL)
+                    goto path_failure;
+            } else if (key == NULL && ptr < end && *ptr == '[') {
+                // the path starts with the items of a top level array
+                name = NULL;
+            } else {
+                goto invalid_path;
+            }
+
+            do {
+                if (name == NULL) {
+                    if (end - ptr < 3 || strncmp(ptr, "[*]", 3) != 0)
+                        goto invalid_path;
+                    ptr += 3;
+                    Py_INCREF(Py_None);
+                    name = Py_None;
+                }
+                // descend into the selection for the previous key
+                if (key != NULL) {
+                    child = PyDict_GetItem(parent, key);
+                    if (child == NULL) {
+                        child = PyDict_New();
+                        if (child == NULL || PyDict_SetItem(parent, key, child) == -1) {
+                            Py_XDECREF(child);
+                            Py_DECREF(name);
+                            goto path_failure;
+                        }
+                        Py_DECREF(child);
+                    } else if (child == Py_None) {
+                        // the whole value is already selected
+                        covered = True;
+                    }
+                    parent = child;
+                    Py_DECREF(key);
+                }
+                key = name;
+                name = NULL;
+            } while (!covered && ptr < end && *ptr == '[');
+
+            if (covered || ptr == end)
+                break;
+            if (*ptr != '.' || ptr+1 == end)
+                goto invalid_path;
+            ptr++;
+        }
+
+        if (!covered && PyDict_SetItem(parent, key, Py_None) == -1)
+            goto path_failure;
+
+        Py_DECREF(key);
+        Py_DECREF(bytes);
+        Py_DECREF(path);
+        continue;
+
+    invalid_path:
+        PyErr_Format(PyExc_ValueError, "invalid field path: %.200s",
+                     PyString_AS_STRING(bytes));
+    path_failure:
+        Py_XDECREF(key);
+        Py_DECREF(bytes);
+    failure:
+        Py_DECREF(path);
+        Py_DECREF(iter);
+        Py_DECREF(root);
+        return NULL;
+    }
+
+    Py_DECREF(iter);
+    if (PyErr_Occurred()) {
+        Py_DECREF(root);
+        return NULL;
+    }
+
+    return root;
+}
+
+
+/* Decode JSON representation into pyhton objects */
+
+static PyObject*
+JSON_decode(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"json", "all_unicode", "max_depth", "fields",
+                             "object_hook", "object_pairs_hook", "array_type",
+                             "use_decimal", "raw_numbers", "numeric_arrays", NULL};
+    int all_unicode = False; // by default return unicode only when needed
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *object, *string, *str, *fields = Py_None;
+    PyObject *object_hook = Py_None, *object_pairs_hook = Py_None;
+    PyObject *array_type = (PyObject*)&PyList_Type;
+    int use_decimal = False, raw_numbers = False, numeric_arrays = False;
+    JSONData jsondata;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|inOOOOiii:decode", kwlist,
+                                     &string, &all_unicode, &max_depth, &fields,
+                                     &object_hook, &object_pairs_hook, &array_type,
+                                     &use_decimal, &raw_numbers, &numeric_arrays))
+        return NULL;
+
+    if (max_depth <= 0) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be a positive integer");
+        return NULL;
+    }
+
+    if (numeric_arrays && (use_decimal || raw_numbers)) {
+        PyErr_SetString(PyExc_ValueError, "numeric_arrays cannot be used with use_decimal or raw_numbers");
+        return NULL;
+    }
+
+    jsondata_init(&jsondata, all_unicode, max_depth);
+
+    if (jsondata_set_options(&jsondata, object_hook, object_pairs_hook,
+                             array_type, use_decimal, raw_numbers) == -1)
+        return NULL;
+    jsondata.numeric_arrays = numeric_arrays;
+
+    if (fields != Py_None) {
+        jsondata.fields = compile_fields(fields);
+        if (jsondata.fields == NULL)
+            return NULL;
+    }
+
+    str = jsondata_set_input(&jsondata, string);
+    if (str == NULL) {
+        Py_XDECREF(jsondata.fields);
+        return NULL;
+    }
+
+    if (jsondata.fields == NULL)
+        object = decode_document_tape(&jsondata);
+    else
+        object = decode_document(&jsondata);
+
+    jsondata_free(&jsondata);
+    Py_XDECREF(jsondata.fields);
+    Py_DECREF(str);
+
+    return object;
+}
+
+
+/* Decode a JSON array of numbers into a writable buffer */
+
+static PyObject*
+JSON_decode_into(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"json", "buffer", "max_depth", NULL};
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *string, *buffer, *str, *object, *result = NULL;
+    Py_ssize_t n, size, itemsize;
+    JSONData jsondata;
+    Scanner scanner;
+    Py_buffer view;
+    char typecode = 0, *format;
+    void *data, *scratch = NULL;
+    Tape tape;
+    int status;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|n:decode_into", kwlist,
+                                     &string, &buffer, &max_depth))
+        return NULL;
+
+    if (max_depth <= 0) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be a positive integer");
+        return NULL;
+    }
+
+    // new style buffers describe their items, array.array only has the old
+    // buffer interface and the type code attribute in python 2
+    view.obj = NULL;
+    if (PyObject_CheckBuffer(buffer)) {
+        if (PyObject_GetBuffer(buffer, &view, PyBUF_C_CONTIGUOUS|PyBUF_FORMAT|PyBUF_WRITABLE) == -1)
+            return NULL;
+        data = view.buf;
+        size = view.len;
+        format = view.format ? view.format : "B";
+        // only the native byte order can be written, which the itemsize check
+        // below tells apart from the standard sizes of the other prefixes
+#ifdef WORDS_BIGENDIAN
+        if (strchr("@=>!", *format) != NULL)
+#else
+        if (strchr("@=<", *format) != NULL)
+#endif
+            format++;
+        if (format[0] && !format[1])
+            typecode = format[0];
+        itemsize = view.itemsize;
+    } else {
+        if (PyObject_AsWriteBuffer(buffer, &data, &size) == -1)
+            return NULL;
+        object = PyObject_GetAttrString(buffer, "typecode");
+        if (object == NULL)
+            PyErr_Clear();
+        else if (PyString_Check(object) && PyString_GET_SIZE(object) == 1)
+            typecode = *PyString_AS_STRING(object);
+        Py_XDECREF(object);
+        itemsize = typecode=='d' ? sizeof(double) : sizeof(long);
+    }
+    if ((typecode != 'l' && typecode != 'd') ||
+        itemsize != (Py_ssize_t)(typecode=='d' ? sizeof(double) : sizeof(long))) {
+        PyErr_SetString(PyExc_TypeError, "buffer must hold C longs ('l') or doubles ('d')");
+        goto release;
+    }
+
+    jsondata_init(&jsondata, False, max_depth);
+
+    // the input is kept alive and unchanged while the GIL is released
+    str = jsondata_set_input(&jsondata, string);
+    if (str == NULL)
+        goto release;
+
+    tape_init(&tape);
+    scanner.str = scanner.ptr = jsondata.ptr;
+    scanner.end = jsondata.end;
+    scanner.max_depth = max_depth;
+    scanner.tape = &tape;
+    scanner.float_spans = scanner.integer_spans = False;
+    scanner.numeric_arrays = True;
+    scanner.single_value = False;
+
+    if (scan_input(&scanner) == -1) {
+        raise_scan_error(&jsondata, &scanner);
+        goto done;
+    }
+
+    // the value is a single entry or an array of numbers with its items
+    if (tape.size == 1 && tape.entries[0].type == TapeArray && tape.entries[0].length == 0) {
+        n = 0;
+    } else if (tape.entries[0].type == TapeNumericArray && tape.size == tape.entries[0].length + 1) {
+        n = tape.entries[0].length;
+    } else {
+        skipSpaces(&jsondata);
+        raise_decode_error(&jsondata, position(&jsondata, jsondata.ptr),
+                           "expecting array of numbers at position " SSIZE_T_F,
+                           position(&jsondata, jsondata.ptr));
+        goto done;
+    }
+
+    if (n > size / itemsize) {
+        PyErr_Format(PyExc_ValueError, "buffer too small for " SSIZE_T_F " items", n);
+        goto done;
+    }
+
+    // the buffer is only written once all the numbers were converted
+    scratch = PyMem_Malloc(n > 0 ? n * itemsize : 1);
+    if (scratch == NULL) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    status = store_numbers(&jsondata, tape.entries + 1, n, typecode, scratch);
+    if (status == 1) {
+        PyErr_Format(PyExc_ValueError, "the numbers cannot be stored exactly"
+                     " in a buffer of '%c' items", typecode);
+    } else if (status == 0) {
+        // an old style buffer can be resized by another thread while the GIL
+        // is released, so its memory is looked up again before writing to it
+        if (view.obj == NULL && PyObject_AsWriteBuffer(buffer, &data, &size) == -1)
+            goto done;
+        if (n > size / itemsize) {
+            PyErr_Format(PyExc_ValueError, "buffer too small for " SSIZE_T_F " items", n);
+            goto done;
+        }
+        memcpy(data, scratch, n * itemsize);
+        result = PyInt_FromSsize_t(n);
+    }
+
+done:
+    PyMem_Free(scratch);
+    tape_free(&tape);
+    jsondata_free(&jsondata);
+    Py_DECREF(str);
+release:
+    if (view.obj != NULL)
+        PyBuffer_Release(&view);
+
+    return result;
+}
+
+
+/* Decode newline delimited JSON representations into a list of python objects */
+
+typedef enum {
+    StrictErrors=0,
+    IgnoreErrors,
+    ReplaceErrors
+} ErrorHandling;
+
+// Add the line number to the message of the pending DecodeError, keeping the
+// position and the input recorded in the other exception arguments. Returns
+// -1 if that fails, with the new error set instead
+static int
+add_error_line(Py_ssize_t lineno)
+{
+    PyObject *type, *value, *tb, *args, *message, *item, *values, *line;
+    Py_ssize_t i, size;
+    int status;
+
+    PyErr_Fetch(&type, &value, &tb);
+    PyErr_NormalizeException(&type, &value, &tb);
+    if (value == NULL)
+        goto failure;
+
+    if (PyObject_TypeCheck(value, (PyTypeObject*)JSON_DecodeError) && has_error_info(value)) {
+        // keep the message lazy by extending the format and its values
+        size = PyTuple_GET_SIZE(error_args(value));
+        args = PyTuple_New(size);
+        if (args == NULL)
+            goto failure;
+        for (i = 0; i < size; i++) {
+            item = PyTuple_GET_ITEM(error_args(value), i);
+            Py_INCREF(item);
+            PyTuple_SET_ITEM(args, i, item);
+        }
+        item = PyString_FromFormat("%s on line %%zd",
+                                   PyString_AS_STRING(PyTuple_GET_ITEM(args, ErrorFormat)));
+        line = Py_BuildValue("(n)", lineno);
+        values = line ? PySequence_Concat(PyTuple_GET_ITEM(args, ErrorValues), line) : NULL;
+        Py_XDECREF(line);
+        if (item == NULL || values == NULL) {
+            Py_XDECREF(item);
+            Py_XDECREF(values);
+            Py_DECREF(args);
+            goto failure;
+        }
+        Py_DECREF(PyTuple_GET_ITEM(args, ErrorFormat));
+        PyTuple_SET_ITEM(args, ErrorFormat, item);
+        Py_DECREF(PyTuple_GET_ITEM(args, ErrorValues));
+        PyTuple_SET_ITEM(args, ErrorValues, values);
+    } else {
+        message = PyObject_Str(value);
+        if (message == NULL)
+            goto failure;
+        args = Py_BuildValue("(N)", PyString_FromFormat("%s on line " SSIZE_T_F,
+                                                        PyString_AS_STRING(message), lineno));
+        Py_DECREF(message);
+        if (args == NULL)
+            goto failure;
+    }
+
+    status = PyObject_SetAttrString(value, "args", args);
+    Py_DECREF(args);
+    if (status < 0)
+        goto failure;
+
+    PyErr_Restore(type, value, tb);
+    return 0;
+
+failure:
+    Py_XDECREF(type);
+    Py_XDECREF(value);
+    Py_XDECREF(tb);
+    return -1;
+}
+
+
+typedef struct LineCounter {
+    Py_ssize_t lineno; // the line number at counted
+    char *counted; // how far the lines were counted
+} LineCounter;
+
+
+/*
+ * Handle the decode error of the document starting at start as error_handling
+ * says: add the line number to the error and raise it, add it to values or
+ * drop it, after which decoding continues with the next line. Returns -1 on
+ * failure.
+ */
+static int
+handle_line_error(JSONData *jsondata, char *start, ErrorHandling error_handling,
+                  PyObject *values, LineCounter *counter)
+{
+    PyObject *type, *value, *tb;
+    int result;
+
+    if (!PyErr_ExceptionMatches(JSON_DecodeError))
+        return -1;
+
+    for (; counter->counted < start; counter->counted++) {
+        if (*counter->counted == '\n')
+            counter->lineno++;
+    }
+
+    if (add_error_line(counter->lineno) == -1)
+        return -1;
+
+    if (error_handling == StrictErrors)
+        return -1;
+
+    if (error_handling == ReplaceErrors) {
+        PyErr_Fetch(&type, &value, &tb);
+        PyErr_NormalizeException(&type, &value, &tb);
+        Py_XDECREF(type);
+        Py_XDECREF(tb);
+        if (value == NULL)
+            return -1;
+        result = PyList_Append(values, value);
+        Py_DECREF(value);
+        if (result == -1)
+            return -1;
+    } else {
+        PyErr_Clear();
+    }
+
+    // continue with the line that follows the one of the bad document
+    jsondata->ptr = memchr(start, '\n', jsondata->end - start);
+    if (jsondata->ptr == NULL)
+        jsondata->ptr = jsondata->end;
+
+    return 0;
+}
+
+
+/*
+ * Decode the document at the current position, which must be alone on its
+ * line, and add it to values. Decode errors are handled by handle_line_error.
+ * Returns -1 on failure.
+ */
+static int
+decode_line(JSONData *jsondata, ErrorHandling error_handling, PyObject *values,
+            LineCounter *counter)
+{
+    PyObject *object;
+    char *start;
+    int result;
+
+    start = jsondata->ptr;
+    object = decode_json(jsondata);
+
+    if (object != NULL) {
+        // the document must be followed by the end of its line
+        while (jsondata->ptr < jsondata->end && *jsondata->ptr != '\n' && isSpace(*jsondata->ptr))
+            jsondata->ptr++;
+        if (jsondata->ptr < jsondata->end && *jsondata->ptr != '\n') {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "extra data after JSON description"
+                               " at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            Py_CLEAR(object);
+        }
+    }
+
+    if (object == NULL)
+        return handle_line_error(jsondata, start, error_handling, values, counter);
+
+    result = PyList_Append(values, object);
+    Py_DECREF(object);
+    return result;
+}
+
+
+// Decode the documents from the current position up to the end of the input
+static int
+decode_remaining_lines(JSONData *jsondata, ErrorHandling error_handling,
+                       PyObject *values, LineCounter *counter)
+{
+    while (True) {
+        // blank lines are skipped
+        skipSpaces(jsondata);
+        if (jsondata->ptr >= jsondata->end)
+            return 0;
+        if (decode_line(jsondata, error_handling, values, counter) == -1)
+            return -1;
+    }
+}
+
+
+/*
+ * With multiple workers the input is split at line boundaries into chunks,
+ * which the worker threads take one at a time and scan into tapes without
+ * the GIL. Then the documents are built from the tapes in order, while the
+ * lines that could not be scanned are decoded again with decode_line, which
+ * raises or handles the error, or decodes documents spanning multiple lines.
+ * The errors of building a document are handled without decoding it again.
+ */
+
+#define LINE_CHUNK_MIN_SIZE 65536
+#define LINE_CHUNKS_PER_WORKER 4
+
+typedef struct LineRecord {
+    char *start; // where the document starts
+    char *end; // the end of its line
+    Py_ssize_t first, last; // its entries on the tape
+    int valid; // the document was scanned successfully
+} LineRecord;
+
+typedef struct LineChunk {
+    char *start, *end; // the lines of the chunk
+    Tape tape; // the scanned documents
+    LineRecord *records; // the documents of the chunk in order
+    Py_ssize_t size; // number of records
+    Py_ssize_t allocated; // number of slots allocated in records
+    int out_of_memory; // scanning stopped for lack of memory
+} LineChunk;
+
+typedef struct LineScan {
+    LineChunk *chunks; // the chunks of the input
+    Py_ssize_t count; // number of chunks
+    Py_ssize_t next; // the next chunk to be scanned
+    int running; // number of worker threads still running
+    PyThread_type_lock lock; // protects next and running
+    PyThread_type_lock done; // released when the worker threads finished
+    Py_ssize_t max_depth; // maximum nesting depth of arrays and objects
+    int float_spans; // record floating point numbers as input spans
+    int integer_spans; // record integers as input spans
+} LineScan;
+
+
+// Scan the documents of a chunk into its tape, one line at a time
+static void
+scan_line_chunk(LineScan *scan, LineChunk *chunk)
+{
+    LineRecord *record;
+    Scanner scanner;
+    Py_ssize_t strings_size;
+    char *ptr;
+
+    scanner.str = chunk->start;
+    scanner.max_depth = scan->max_depth;
+    scanner.tape = &chunk->tape;
+    scanner.float_spans = scan->float_spans;
+    scanner.integer_spans = scan->integer_spans;
+    scanner.numeric_arrays = False;
+    scanner.single_value = False;
+
+    ptr = chunk->start;
+    while (True) {
+        while (ptr < chunk->end && isSpace(*ptr))
+            ptr++;
+        if (ptr >= chunk->end)
+            break;
+
+        if (chunk->size == chunk->allocated) {
+            Py_ssize_t allocated;
+
+            allocated = chunk->allocated ? chunk->allocated*2 : TAPE_INITIAL_SIZE;
+            if (allocated > PY_SSIZE_T_MAX / (Py_ssize_t)sizeof(LineRecord))
+                record = NULL;
+            else
+                record = realloc(chunk->records, allocated * sizeof(LineRecord));
+            if (record == NULL) {
+                chunk->out_of_memory = True;
+                return;
+            }
+            chunk->records = record;
+            chunk->allocated = allocated;
+        }
+
+        record = &chunk->records[chunk->size++];
+        record->start = ptr;
+        record->end = memchr(ptr, '\n', chunk->end - ptr);
+        if (record->end == NULL)
+            record->end = chunk->end;
+        record->first = chunk->tape.size;
+        strings_size = chunk->tape.strings_size;
+
+        scanner.ptr = ptr;
+        scanner.end = record->end;
+        record->valid = (scan_document(&scanner) == 0);
+        if (!record->valid) {
+            if (scanner.error == OutOfMemory) {
+                chunk->out_of_memory = True;
+                return;
+            }
+            chunk->tape.size = record->first;
+            chunk->tape.strings_size = strings_size;
+        }
+        record->last = chunk->tape.size;
+
+        ptr = record->end;
+    }
+}
+
+
+// Take chunks to scan until none is left
+static void
+scan_line_chunks(LineScan *scan)
+{
+    Py_ssize_t index;
+
+    while (True) {
+        PyThread_acquire_lock(scan->lock, WAIT_LOCK);
+        index = scan->next++;
+        PyThread_release_lock(scan->lock);
+        if (index >= scan->count)
+            break;
+        scan_line_chunk(scan, &scan->chunks[index]);
+    }
+}
+
+
+static void
+line_scan_thread(void *arg)
+{
+    LineScan *scan = (LineScan*)arg;
+    int last;
+
+    scan_line_chunks(scan);
+
+    PyThread_acquire_lock(scan->lock, WAIT_LOCK);
+    last = (--scan->running == 0);
+    PyThread_release_lock(scan->lock);
+    if (last)
+        PyThread_release_lock(scan->done);
+}
+
+
+// Scan the chunks with the given number of threads, including the current one
+static void
+scan_lines(LineScan *scan, int threads)
+{
+    int i, last;
+
+    scan->running = threads - 1;
+    for (i = 1; i < threads; i++) {
+        if (PyThread_start_new_thread(line_scan_thread, scan) == -1) {
+            // the remaining chunks are scanned by the threads already running
+            PyThread_acquire_lock(scan->lock, WAIT_LOCK);
+            scan->running -= threads - i;
+            last = (scan->running == 0);
+            PyThread_release_lock(scan->lock);
+            if (last)
+                PyThread_release_lock(scan->done);
+            break;
+        }
+    }
+
+    scan_line_chunks(scan);
+
+    if (threads > 1)
+        PyThread_acquire_lock(scan->done, WAIT_LOCK);
+}
+
+
+// Decode the documents up to the end of the input using multiple workers
+static int
+decode_lines_parallel(JSONData *jsondata, int workers, ErrorHandling error_handling,
+                      PyObject *values, LineCounter *counter)
+{
+    LineScan scan;
+    LineChunk *chunk;
+    LineRecord *record;
+    PyObject *object;
+    Py_ssize_t size, count, i, j;
+    char *ptr, *split;
+    int result = -1;
+
+    size = jsondata->end - jsondata->ptr;
+    count = size / LINE_CHUNK_MIN_SIZE;
+    if (count > workers * LINE_CHUNKS_PER_WORKER)
+        count = workers * LINE_CHUNKS_PER_WORKER;
+    if (count <= 1)
+        return decode_remaining_lines(jsondata, error_handling, values, counter);
+
+    scan.chunks = PyMem_New(LineChunk, count);
+    if (scan.chunks == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    // split the input after the newlines closest to equal parts
+    ptr = jsondata->ptr;
+    for (i = 0; i < count; i++) {
+        chunk = &scan.chunks[i];
+        chunk->start = ptr;
+        split = jsondata->ptr + size / count * (i+1);
+        if (i == count-1) {
+            ptr = jsondata->end;
+        } else if (ptr < split) {
+            ptr = memchr(split, '\n', jsondata->end - split);
+            ptr = ptr ? ptr + 1 : jsondata->end;
+        }
+        chunk->end = ptr;
+        tape_init(&chunk->tape);
+        chunk->records = NULL;
+        chunk->size = chunk->allocated = 0;
+        chunk->out_of_memory = False;
+    }
+
+    scan.count = count;
+    scan.next = 0;
+    scan.max_depth = jsondata->max_depth;
+    scan.float_spans = (jsondata->decimal_type != NULL || jsondata->raw_numbers);
+    scan.integer_spans = jsondata->raw_numbers;
+    scan.lock = PyThread_allocate_lock();
+    scan.done = PyThread_allocate_lock();
+    if (scan.lock == NULL || scan.done == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "cannot allocate lock");
+        goto done;
+    }
+    PyThread_acquire_lock(scan.done, WAIT_LOCK);
+
+    Py_BEGIN_ALLOW_THREADS
+    scan_lines(&scan, workers < count ? workers : (int)count);
+    Py_END_ALLOW_THREADS
+
+    for (i = 0; i < count; i++) {
+        if (scan.chunks[i].out_of_memory) {
+            PyErr_NoMemory();
+            goto done;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        chunk = &scan.chunks[i];
+        for (j = 0; j < chunk->size; j++) {
+            record = &chunk->records[j];
+
+            // decode what precedes the document, like the rest of a document
+            // spanning multiple lines that ended in an invalid record
+            while (True) {
+                skipSpaces(jsondata);
+                if (jsondata->ptr >= record->start)
+                    break;
+                if (decode_line(jsondata, error_handling, values, counter) == -1)
+                    goto done;
+            }
+            if (jsondata->ptr > record->start)
+                continue;
+
+            if (record->valid) {
+                object = build_tape(jsondata, &chunk->tape, record->first, record->last);
+                if (object != NULL) {
+                    result = PyList_Append(values, object);
+                    Py_DECREF(object);
+                    if (result == -1)
+                        goto done;
+                    result = -1;
+                    jsondata->ptr = record->end;
+                    continue;
+                }
+                // strings that cannot be decoded and errors of the hooks are
+                // handled here, as decoding the line again would call the
+                // hooks twice
+                if (handle_line_error(jsondata, record->start, error_handling,
+                                      values, counter) == -1)
+                    goto done;
+                continue;
+            }
+            if (decode_line(jsondata, error_handling, values, counter) == -1)
+                goto done;
+        }
+    }
+
+    result = decode_remaining_lines(jsondata, error_handling, values, counter);
+
+done:
+    for (i = 0; i < count; i++) {
+        tape_free(&scan.chunks[i].tape);
+        free(scan.chunks[i].records);
+    }
+    PyMem_Free(scan.chunks);
+    if (scan.lock != NULL)
+        PyThread_free_lock(scan.lock);
+    if (scan.done != NULL)
+        PyThread_free_lock(scan.done);
+    return result;
+}
+
+
+static PyObject*
+JSON_decode_lines(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"json", "all_unicode", "max_depth", "errors", "fields",
+                             "object_hook", "object_pairs_hook", "array_type",
+                             "use_decimal", "raw_numbers", "workers", NULL};
+    int all_unicode = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    char *errors = "strict";
+    ErrorHandling error_handling;
+    PyObject *values, *string, *str, *fields = Py_None;
+    PyObject *object_hook = Py_None, *object_pairs_hook = Py_None;
+    PyObject *array_type = (PyObject*)&PyList_Type;
+    int use_decimal = False, raw_numbers = False, workers = 1;
+    JSONData jsondata;
+    LineCounter counter;
+    int result;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|insOOOOiii:decode_lines", kwlist,
+                                     &string, &all_unicode, &max_depth, &errors,
+                                     &fields, &object_hook, &object_pairs_hook,
+                                     &array_type, &use_decimal, &raw_numbers,
+                                     &workers))
+        return NULL;
+
+    if (max_depth <= 0) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be a positive integer");
+        return NULL;
+    }
+
+    if (workers <= 0) {
+        PyErr_SetString(PyExc_ValueError, "workers must be a positive integer");
+        return NULL;
+    }
+
+    if (strcmp(errors, "strict") == 0) {
+        error_handling = StrictErrors;
+    } else if (strcmp(errors, "ignore") == 0) {
+        error_handling = IgnoreErrors;
+    } else if (strcmp(errors, "replace") == 0) {
+        error_handling = ReplaceErrors;
+    } else {
+        PyErr_Format(PyExc_ValueError, "unknown error handling: %.50s", errors);
+        return NULL;
+    }
+
+    values = PyList_New(0);
+    if (values == NULL)
+        return NULL;
+
+    jsondata_init(&jsondata, all_unicode, max_depth);
+
+    if (jsondata_set_options(&jsondata, object_hook, object_pairs_hook,
+                             array_type, use_decimal, raw_numbers) == -1) {
+        Py_DECREF(values);
+        return NULL;
+    }
+
+    if (fields != Py_None) {
+        jsondata.fields = compile_fields(fields);
+        if (jsondata.fields == NULL) {
+            Py_DECREF(values);
+            return NULL;
+        }
+    }
+
+    str = jsondata_set_input(&jsondata, string);
+    if (str == NULL) {
+        Py_XDECREF(jsondata.fields);
+        Py_DECREF(values);
+        return NULL;
+    }
+
+    // line numbers are only needed for errors, so they are counted lazily
+    counter.lineno = 1;
+    counter.counted = jsondata.str;
+
+    if (workers > 1 && jsondata.fields == NULL)
+        result = decode_lines_parallel(&jsondata, workers, error_handling, values, &counter);
+    else
+        result = decode_remaining_lines(&jsondata, error_handling, values, &counter);
+    if (result == -1)
+        goto failure;
+
+    jsondata_free(&jsondata);
+    Py_XDECREF(jsondata.fields);
+    Py_DECREF(str);
+
+    return values;
+
+failure:
+    jsondata_free(&jsondata);
+    Py_XDECREF(jsondata.fields);
+    Py_DECREF(str);
+    Py_DECREF(values);
+    return NULL;
+}
+
+
+/* ---------------------------- Input buffer --------------------------- */
+
+typedef struct InputBuffer {
+    char *data; // the input not consumed yet, always NUL terminated
+    Py_ssize_t size; // the size of the input in data
+    Py_ssize_t allocated; // the size of the memory allocated for data
+} InputBuffer;
+
+
+static void
+buffer_clear(InputBuffer *buffer)
+{
+    buffer->size = 0;
+    if (buffer->data != NULL)
+        buffer->data[0] = 0;
+}
+
+
+static int
+buffer_append(InputBuffer *buffer, char *data, Py_ssize_t size)
+{
+    if (size > PY_SSIZE_T_MAX - buffer->size - 1) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    if (buffer->size + size + 1 > buffer->allocated) {
+        Py_ssize_t allocated;
+        char *new_data;
+
+        allocated = buffer->allocated ? buffer->allocated : INPUT_BUFFER_INITIAL_SIZE;
+        while (allocated < buffer->size + size + 1 && allocated <= PY_SSIZE_T_MAX/2)
+            allocated *= 2;
+        if (allocated < buffer->size + size + 1)
+            allocated = buffer->size + size + 1;
+        new_data = PyMem_Realloc(buffer->data, allocated);
+        if (new_data == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        buffer->data = new_data;
+        buffer->allocated = allocated;
+    }
+
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    buffer->data[buffer->size] = 0;
+
+    return 0;
+}
+
+
+// Discard the input already consumed by the decoder and point it to what remains
+static void
+buffer_consume(InputBuffer *buffer, JSONData *jsondata)
+{
+    Py_ssize_t consumed;
+
+    if (buffer->data == NULL)
+        return;
+
+    consumed = jsondata->ptr - jsondata->str;
+    if (consumed > 0) {
+        buffer->size -= consumed;
+        memmove(buffer->data, jsondata->ptr, buffer->size + 1);
+        jsondata->offset += consumed;
+    }
+    jsondata->str = jsondata->ptr = buffer->data;
+    jsondata->end = buffer->data + buffer->size;
+}
+
+
+static void
+buffer_free(InputBuffer *buffer)
+{
+    PyMem_Free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = buffer->allocated = 0;
+}
+
+
+// Start decoding from a stream, with an empty input that will be filled as needed
+static int
+buffer_start_stream(InputBuffer *buffer, JSONData *jsondata)
+{
+    if (buffer_append(buffer, "", 0) == -1)
+        return -1;
+    buffer_consume(buffer, jsondata);
+    jsondata->partial = True;
+    return 0;
+}
+
+
+/*
+ * Read the next chunk of the input from a stream, using its read method, and
+ * point the decoder to the input not consumed yet. When the end of the stream
+ * is reached the decoder input is no longer partial. Returns 0 on success and
+ * -1 on error.
+ */
+static int
+buffer_read_stream(InputBuffer *buffer, JSONData *jsondata, PyObject *read)
+{
+    PyObject *chunk;
+    char *data;
+    Py_ssize_t size;
+    int result;
+
+    chunk = PyObject_CallFunction(read, "n", (Py_ssize_t)STREAM_CHUNK_SIZE);
+    if (chunk == NULL)
+        return -1;
+    if (PyString_AsStringAndSize(chunk, &data, &size) == -1) {
+        Py_DECREF(chunk);
+        return -1;
+    }
+
+    buffer_consume(buffer, jsondata);
+    if (size == 0) {
+        jsondata->partial = False;
+        result = 0;
+    } else {
+        result = buffer_append(buffer, data, size);
+        // the data might have been moved
+        buffer_consume(buffer, jsondata);
+    }
+
+    Py_DECREF(chunk);
+
+    return result;
+}
+
+
+/* ------------------------- Incremental decoding ---------------------- */
+
+typedef struct {
+    PyObject_HEAD
+    JSONData jsondata; // the decoder state preserved between chunks
+    InputBuffer buffer; // the input not consumed yet
+} IncrementalDecoder;
+
+
+static void
+IncrementalDecoder_reset(IncrementalDecoder *self)
+{
+    stack_pop_to(&self->jsondata.stack, 0);
+    self->jsondata.containers.size = 0;
+    self->jsondata.string_scan.length = 0;
+    self->jsondata.offset = 0;
+    buffer_clear(&self->buffer);
+}
+
+
+static int
+IncrementalDecoder_init(IncrementalDecoder *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"all_unicode", "max_depth", NULL};
+    int all_unicode = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|in:IncrementalDecoder", kwlist,
+                                     &all_unicode, &max_depth))
+        return -1;
+
+    if (max_depth <= 0) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be a positive integer");
+        return -1;
+    }
+
+    IncrementalDecoder_reset(self);
+    jsondata_free(&self->jsondata);
+    jsondata_init(&self->jsondata, all_unicode, max_depth);
+
+    return 0;
+}
+
+
+static void
+IncrementalDecoder_dealloc(IncrementalDecoder *self)
+{
+    jsondata_free(&self->jsondata);
+    buffer_free(&self->buffer);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+
+// Decode all the values that are complete in the buffered input
+static PyObject*
+IncrementalDecoder_decode(IncrementalDecoder *self, int final)
+{
+    JSONData *jsondata = &self->jsondata;
+    PyObject *values, *object;
+
+    values = PyList_New(0);
+    if (values == NULL)
+        return NULL;
+
+    jsondata->str = jsondata->ptr = self->buffer.data;
+    jsondata->end = self->buffer.data + self->buffer.size;
+    jsondata->partial = !final;
+
+    while (True) {
+        if (jsondata->containers.size == 0) {
+            skipSpaces(jsondata);
+            if (jsondata->ptr == jsondata->end)
+                break;
+        }
+        object = decode_json(jsondata);
+        if (object == NULL) {
+            if (jsondata->incomplete)
+                break;
+            goto failure;
+        }
+        if (PyList_Append(values, object) == -1) {
+            Py_DECREF(object);
+            goto failure;
+        }
+        Py_DECREF(object);
+    }
+
+    // discard the consumed input, keeping only the incomplete token (if any)
+    buffer_consume(&self->buffer, jsondata);
+
+    if (final)
+        IncrementalDecoder_reset(self);
+
+    return values;
+
+failure:
+    IncrementalDecoder_reset(self);
+    Py_DECREF(values);
+    return NULL;
+}
+
+
+static PyObject*
+IncrementalDecoder_feed(IncrementalDecoder *self, PyObject *args)
+{
+
+    Py_buffer data;
+    int result;
+
+    if (!PyArg_ParseTuple(args, "s*:feed", &data))
+        return NULL;
+
+    result = buffer_append(&self->buffer, data.buf, data.len);
+    PyBuffer_Release(&data);
+    if (result == -1)
+        return NULL;
+
+    return IncrementalDecoder_decode(self, False);
+}
+
+
+static PyObject*
+IncrementalDecoder_close(IncrementalDecoder *self)
+{
+    if (self->buffer.data == NULL)
+        return PyList_New(0);
+    return IncrementalDecoder_decode(self, True);
+}
+
+
+static PyMethodDef IncrementalDecoder_methods[] = {
+    {"feed", (PyCFunction)IncrementalDecoder_feed, METH_VARARGS,
+    PyDoc_STR("feed(data) -> add the next chunk of the JSON input and return a list\n"
+              "with the values that were completed by it. A value can be split at\n"
+              "any point between chunks, even inside a string, number or literal.")},
+
+    {"close", (PyCFunction)IncrementalDecoder_close, METH_NOARGS,
+    PyDoc_STR("close() -> signal the end of the JSON input and return a list with the\n"
+              "values that were still pending. Raises DecodeError if the input ends\n"
+              "in the middle of a value. The decoder can be reused afterwards.")},
+
+    {NULL, NULL}  // sentinel
+};
+
+PyDoc_STRVAR(IncrementalDecoder_doc,
+"IncrementalDecoder(all_unicode=False, max_depth=" string(DEFAULT_MAX_DEPTH) ") -> decoder for a JSON input\n"
+"that arrives in chunks. The input is a stream of JSON values, optionally\n"
+"separated by whitespace, that are returned as soon as they are complete.\n"
+"The arguments have the same meaning as for decode. After an error was\n"
+"raised, the decoder is reset and any pending input is discarded."
+);
+
+static PyTypeObject IncrementalDecoder_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cjson.IncrementalDecoder",                 // tp_name
+    sizeof(IncrementalDecoder),                 // tp_basicsize
+    0,                                          // tp_itemsize
+    (destructor)IncrementalDecoder_dealloc,     // tp_dealloc
+    0,                                          // tp_print
+    0,                                          // tp_getattr
+    0,                                          // tp_setattr
+    0,                                          // tp_compare
+    0,                                          // tp_repr
+    0,                                          // tp_as_number
+    0,                                          // tp_as_sequence
+    0,                                          // tp_as_mapping
+    0,                                          // tp_hash
+    0,                                          // tp_call
+    0,                                          // tp_str
+    0,                                          // tp_getattro
+    0,                                          // tp_setattro
+    0,                                          // tp_as_buffer
+    Py_TPFLAGS_DEFAULT,                         // tp_flags
+    IncrementalDecoder_doc,                     // tp_doc
+    0,                                          // tp_traverse
+    0,                                          // tp_clear
+    0,                                          // tp_richcompare
+    0,                                          // tp_weaklistoffset
+    0,                                          // tp_iter
+    0,                                          // tp_iternext
+    IncrementalDecoder_methods,                 // tp_methods
+    0,                                          // tp_members
+    0,                                          // tp_getset
+    0,                                          // tp_base
+    0,                                          // tp_dict
+    0,                                          // tp_descr_get
+    0,                                          // tp_descr_set
+    0,                                          // tp_dictoffset
+    (initproc)IncrementalDecoder_init,          // tp_init
+    0,                                          // tp_alloc
+    PyType_GenericNew,                          // tp_new
+};
+
+
+/* --------------------------- Parsing events -------------------------- */
+
+typedef struct {
+    PyObject_HEAD
+    JSONData jsondata; // the parser state
+    PyObject *string; // the JSON input when given as a string or buffer
+    PyObject *read; // the read method of the JSON input when given as a stream
+    InputBuffer buffer; // the input read from the stream not consumed yet
+    int done; // the JSON value was completely parsed
+} EventIterator;
+
+
+static void
+EventIterator_dealloc(EventIterator *self)
+{
+    PyObject_GC_UnTrack(self);
+    jsondata_free(&self->jsondata);
+    buffer_free(&self->buffer);
+    Py_XDECREF(self->string);
+    Py_XDECREF(self->read);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+
+static int
+EventIterator_traverse(EventIterator *self, visitproc visit, void *arg)
+{
+    Py_VISIT(self->string);
+    Py_VISIT(self->read);
+    return 0;
+}
+
+
+// Drop the references to the input, after which the iteration stops
+static int
+EventIterator_clear(EventIterator *self)
+{
+    self->done = True;
+    self->jsondata.partial = False;
+    self->jsondata.ptr = self->jsondata.end = self->jsondata.str;
+    Py_CLEAR(self->string);
+    Py_CLEAR(self->read);
+    return 0;
+}
+
+
+static PyObject*
+EventIterator_next(EventIterator *self)
+{
+    JSONData *jsondata = &self->jsondata;
+    PyObject *event;
+
+    while (self->done) {
+        skipSpaces(jsondata);
+        if (jsondata->ptr < jsondata->end) {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "extra data after JSON description"
+                               " at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            jsondata->ptr = jsondata->end;
+            return NULL;
+        }
+        if (!jsondata->partial)
+            return NULL;
+        if (buffer_read_stream(&self->buffer, jsondata, self->read) == -1)
+            return NULL;
+    }
+
+    while (True) {
+        event = decode_json(jsondata);
+        if (event != NULL)
+            break;
+        if (!jsondata->incomplete ||
+            buffer_read_stream(&self->buffer, jsondata, self->read) == -1) {
+            self->done = True;
+            jsondata->ptr = jsondata->end;
+            return NULL;
+        }
+    }
+
+    if (jsondata->containers.size == 0)
+        self->done = True;
+
+    return event;
+}
+
+
+PyDoc_STRVAR(EventIterator_doc,
+"Iterator over the parsing events of a JSON representation, returned by\n"
+"events. Every event is an (event, value) tuple."
+);
+
+static PyTypeObject EventIterator_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cjson.EventIterator",                      // tp_name
+    sizeof(EventIterator),                      // tp_basicsize
+    0,                                          // tp_itemsize
+    (destructor)EventIterator_dealloc,          // tp_dealloc
+    0,                                          // tp_print
+    0,                                          // tp_getattr
+    0,                                          // tp_setattr
+    0,                                          // tp_compare
+    0,                                          // tp_repr
+    0,                                          // tp_as_number
+    0,                                          // tp_as_sequence
+    0,                                          // tp_as_mapping
+    0,                                          // tp_hash
+    0,                                          // tp_call
+    0,                                          // tp_str
+    PyObject_GenericGetAttr,                    // tp_getattro
+    0,                                          // tp_setattro
+    0,                                          // tp_as_buffer
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,    // tp_flags
+    EventIterator_doc,                          // tp_doc
+    (traverseproc)EventIterator_traverse,       // tp_traverse
+    (inquiry)EventIterator_clear,               // tp_clear
+    0,                                          // tp_richcompare
+    0,                                          // tp_weaklistoffset
+    PyObject_SelfIter,                          // tp_iter
+    (iternextfunc)EventIterator_next,           // tp_iternext
+};
+
+
+/* Iterate over the parsing events of a JSON representation */
+
+static PyObject*
+JSON_events(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"json", "all_unicode", "max_depth", NULL};
+    int all_unicode = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *json;
+    EventIterator *iterator;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|in:events", kwlist,
+                                     &json, &all_unicode, &max_depth))
+        return NULL;
+
+    if (max_depth <= 0) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be a positive integer");
+        return NULL;
+    }
+
+    iterator = PyObject_GC_New(EventIterator, &EventIterator_Type);
+    if (iterator == NULL)
+        return NULL;
+
+    jsondata_init(&iterator->jsondata, all_unicode, max_depth);
+    iterator->jsondata.events = True;
+    iterator->string = NULL;
+    iterator->read = NULL;
+    iterator->buffer.data = NULL;
+    iterator->buffer.size = iterator->buffer.allocated = 0;
+    iterator->done = False;
+
+    if (PyString_Check(json) || PyUnicode_Check(json) ||
+        PyObject_CheckBuffer(json) || PyObject_CheckReadBuffer(json)) {
+        iterator->string = jsondata_set_input(&iterator->jsondata, json);
+        if (iterator->string == NULL)
+            goto failure;
+    } else {
+        iterator->read = PyObject_GetAttrString(json, "read");
+        if (iterator->read == NULL) {
+            PyErr_SetString(PyExc_TypeError, "events() argument 1 must be a string "
+                            "or an object with a read method");
+            goto failure;
+        }
+        if (buffer_start_stream(&iterator->buffer, &iterator->jsondata) == -1)
+            goto failure;
+    }
+
+    PyObject_GC_Track(iterator);
+    return (PyObject*)iterator;
+
+failure:
+    Py_DECREF(iterator);
+    return NULL;
+}
+
+
+/* ------------------------ Concatenated documents --------------------- */
+
+typedef struct {
+    PyObject_HEAD
+    JSONData jsondata; // the parser state
+    PyObject *string; // the object holding the JSON input
+} DocumentIterator;
+
+
+static void
+DocumentIterator_dealloc(DocumentIterator *self)
+{
+    PyObject_GC_UnTrack(self);
+    jsondata_free(&self->jsondata);
+    Py_XDECREF(self->jsondata.object_hook);
+    Py_XDECREF(self->jsondata.object_pairs_hook);
+    Py_XDECREF(self->string);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+
+static int
+DocumentIterator_traverse(DocumentIterator *self, visitproc visit, void *arg)
+{
+    Py_VISIT(self->string);
+    Py_VISIT(self->jsondata.object_hook);
+    Py_VISIT(self->jsondata.object_pairs_hook);
+    return 0;
+}
+
+
+// Drop the references to the input and the hooks, after which the iteration stops
+static int
+DocumentIterator_clear(DocumentIterator *self)
+{
+    self->jsondata.ptr = self->jsondata.end = self->jsondata.str;
+    Py_CLEAR(self->string);
+    Py_CLEAR(self->jsondata.object_hook);
+    Py_CLEAR(self->jsondata.object_pairs_hook);
+    return 0;
+}
+
+
+static PyObject*
+DocumentIterator_next(DocumentIterator *self)
+{
+    JSONData *jsondata = &self->jsondata;
+    PyObject *object;
+
+    skipSpaces(jsondata);
+    if (jsondata->ptr >= jsondata->end)
+        return NULL;
+
+    object = decode_json(jsondata);
+    if (object == NULL)
+        jsondata->ptr = jsondata->end; // stop after an error
+
+    return object;
+}
+
+
+PyDoc_STRVAR(DocumentIterator_doc,
+"Iterator over the concatenated JSON representations of the input,\n"
+"returned by decode_all."
+);
+
+static PyTypeObject DocumentIterator_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cjson.DocumentIterator",                   // tp_name
+    sizeof(DocumentIterator),                   // tp_basicsize
+    0,                                          // tp_itemsize
+    (destructor)DocumentIterator_dealloc,       // tp_dealloc
+    0,                                          // tp_print
+    0,                                          // tp_getattr
+    0,                                          // tp_setattr
+    0,                                          // tp_compare
+    0,                                          // tp_repr
+    0,                                          // tp_as_number
+    0,                                          // tp_as_sequence
+    0,                                          // tp_as_mapping
+    0,                                          // tp_hash
+    0,                                          // tp_call
+    0,                                          // tp_str
+    PyObject_GenericGetAttr,                    // tp_getattro
+    0,                                          // tp_setattro
+    0,                                          // tp_as_buffer
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,    // tp_flags
+    DocumentIterator_doc,                       // tp_doc
+    (traverseproc)DocumentIterator_traverse,    // tp_traverse
+    (inquiry)DocumentIterator_clear,            // tp_clear
+    0,                                          // tp_richcompare
+    0,                                          // tp_weaklistoffset
+    PyObject_SelfIter,                          // tp_iter
+    (iternextfunc)DocumentIterator_next,        // tp_iternext
+};
+
+
+/* Decode the JSON representation at the start position of the input, ignoring what follows it */
+
+static PyObject*
+JSON_raw_decode(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"json", "start", "all_unicode", "max_depth",
+                             "object_hook", "object_pairs_hook", "array_type",
+                             "use_decimal", "raw_numbers", NULL};
+    int all_unicode = False;
+    Py_ssize_t start = 0, max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *object, *string, *str, *result;
+    PyObject *object_hook = Py_None, *object_pairs_hook = Py_None;
+    PyObject *array_type = (PyObject*)&PyList_Type;
+    int use_decimal = False, raw_numbers = False;
+    JSONData jsondata;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ninOOOii:raw_decode", kwlist,
+                                     &string, &start, &all_unicode, &max_depth,
+                                     &object_hook, &object_pairs_hook, &array_type,
+                                     &use_decimal, &raw_numbers))
+        return NULL;
+
+    if (max_depth <= 0) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be a positive integer");
+        return NULL;
+    }
+
+    jsondata_init(&jsondata, all_unicode, max_depth);
+
+    if (jsondata_set_options(&jsondata, object_hook, object_pairs_hook,
+                             array_type, use_decimal, raw_numbers) == -1)
+        return NULL;
+
+    // the positions in the encoding of unicode input cannot index the input
+    if (PyUnicode_Check(string)) {
+        PyErr_SetString(PyExc_TypeError, "raw_decode does not take unicode input,"
+                        " use decode_all to iterate over its representations");
+        return NULL;
+    }
+
+    str = jsondata_set_input(&jsondata, string);
+    if (str == NULL)
+        return NULL;
+
+    if (start < 0 || start > jsondata.end - jsondata.str) {
+        PyErr_SetString(PyExc_ValueError, "start is outside of the JSON input");
+        Py_DECREF(str);
+        return NULL;
+    }
+    jsondata.ptr += start;
+
+    object = decode_json(&jsondata);
+    if (object != NULL)
+        result = Py_BuildValue("(Nn)", object, position(&jsondata, jsondata.ptr));
+    else
+        result = NULL;
+
+    jsondata_free(&jsondata);
+    Py_DECREF(str);
+
+    return result;
+}
+
+
+/* Iterate over the JSON representations that follow each other in the input */
+
+static PyObject*
+JSON_decode_all(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"json", "all_unicode", "max_depth",
+                             "object_hook", "object_pairs_hook", "array_type",
+                             "use_decimal", "raw_numbers", NULL};
+    int all_unicode = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *string;
+    PyObject *object_hook = Py_None, *object_pairs_hook = Py_None;
+    PyObject *array_type = (PyObject*)&PyList_Type;
+    int use_decimal = False, raw_numbers = False;
+    DocumentIterator *iterator;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|inOOOii:decode_all", kwlist,
+                                     &string, &all_unicode, &max_depth,
+                                     &object_hook, &object_pairs_hook, &array_type,
+                                     &use_decimal, &raw_numbers))
+        return NULL;
+
+    if (max_depth <= 0) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be a positive integer");
+        return NULL;
+    }
+
+    iterator = PyObject_GC_New(DocumentIterator, &DocumentIterator_Type);
+    if (iterator == NULL)
+        return NULL;
+
+    jsondata_init(&iterator->jsondata, all_unicode, max_depth);
+    iterator->string = NULL;
+
+    if (jsondata_set_options(&iterator->jsondata, object_hook, object_pairs_hook,
+                             array_type, use_decimal, raw_numbers) == -1) {
+        iterator->jsondata.object_hook = iterator->jsondata.object_pairs_hook = NULL;
+        Py_DECREF(iterator);
+        return NULL;
+    }
+    // the hooks are borrowed by the decoder, so the iterator keeps them alive
+    Py_XINCREF(iterator->jsondata.object_hook);
+    Py_XINCREF(iterator->jsondata.object_pairs_hook);
+
+    iterator->string = jsondata_set_input(&iterator->jsondata, string);
+    if (iterator->string == NULL) {
+        Py_DECREF(iterator);
+        return NULL;
+    }
+
+    PyObject_GC_Track(iterator);
+    return (PyObject*)iterator;
+}
+
+
+/* ---------------------------- File decoding -------------------------- */
+
+/*
+ * Memory map the regular file behind a file object. Returns a new reference
+ * to the read only mmap object and stores in offset the current position of
+ * the file object. Returns NULL without setting an exception if the file
+ * cannot be mapped, in which case it should be read as a stream instead.
+ */
+static PyObject*
+map_file(PyObject *file, Py_ssize_t *offset)
+{
+    PyObject *result, *module, *mapping;
+    PyObject *mmap_type, *mmap_args, *mmap_kwargs, *access;
+    struct stat st;
+    long fd;
+
+    result = PyObject_CallMethod(file, "fileno", NULL);
+    if (result == NULL)
+        goto not_mapped;
+    fd = PyInt_AsLong(result);
+    Py_DECREF(result);
+    if (fd == -1 && PyErr_Occurred())
+        goto not_mapped;
+
+    // empty files cannot be mapped and neither can pipes, sockets or ttys
+    if (fstat((int)fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        goto not_mapped;
+
+    result = PyObject_CallMethod(file, "tell", NULL);
+    if (result == NULL)
+        goto not_mapped;
+    *offset = PyInt_AsSsize_t(result);
+    Py_DECREF(result);
+    if (*offset == -1 && PyErr_Occurred())
+        goto not_mapped;
+
+    // the access mode can only be given as a keyword argument portably
+    module = PyImport_ImportModule("mmap");
+    if (module == NULL)
+        goto not_mapped;
+    mmap_type = PyObject_GetAttrString(module, "mmap");
+    access = PyObject_GetAttrString(module, "ACCESS_READ");
+    Py_DECREF(module);
+    mmap_args = Py_BuildValue("(ln)", fd, (Py_ssize_t)0);
+    mmap_kwargs = access ? Py_BuildValue("{sO}", "access", access) : NULL;
+    if (mmap_type != NULL && mmap_args != NULL && mmap_kwargs != NULL)
+        mapping = PyObject_Call(mmap_type, mmap_args, mmap_kwargs);
+    else
+        mapping = NULL;
+    Py_XDECREF(mmap_type);
+    Py_XDECREF(access);
+    Py_XDECREF(mmap_args);
+    Py_XDECREF(mmap_kwargs);
+    if (mapping == NULL)
+        goto not_mapped;
+
+    return mapping;
+
+not_mapped:
+    PyErr_Clear();
+    return NULL;
+}
+
+
+// Decode the JSON value that makes up the whole stream, reading it in chunks
+static PyObject*
+decode_stream(JSONData *jsondata, PyObject *read)
+{
+    PyObject *object = NULL;
+    InputBuffer buffer = {NULL, 0, 0};
+
+    if (buffer_start_stream(&buffer, jsondata) == -1)
+        goto failure;
+
+    while ((object = decode_json(jsondata)) == NULL) {
+        if (!jsondata->incomplete)
+            goto failure;
+        if (buffer_read_stream(&buffer, jsondata, read) == -1)
+            goto failure;
+    }
+
+    // only whitespace may follow until the end of the stream
+    while (True) {
+        skipSpaces(jsondata);
+        if (jsondata->ptr < jsondata->end) {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "extra data after JSON description"
+                               " at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            goto failure;
+        }
+        if (!jsondata->partial)
+            break;
+        if (buffer_read_stream(&buffer, jsondata, read) == -1)
+            goto failure;
+    }
+
+    buffer_free(&buffer);
+
+    return object;
+
+failure:
+    Py_XDECREF(object);
+    buffer_free(&buffer);
+    return NULL;
+}
+
+
+/* Decode the JSON representation stored in a file into python objects */
+
+static PyObject*
+JSON_decode_file(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"file", "all_unicode", "max_depth", "object_hook",
+                             "object_pairs_hook", "array_type", "use_decimal",
+                             "raw_numbers", NULL};
+    int all_unicode = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *object, *file, *mapping, *read, *result;
+    PyObject *object_hook = Py_None, *object_pairs_hook = Py_None;
+    PyObject *array_type = (PyObject*)&PyList_Type;
+    int use_decimal = False, raw_numbers = False;
+    JSONData jsondata;
+    Py_ssize_t offset, size;
+    const void *data;
+    int opened;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|inOOOii:decode_file", kwlist,
+                                     &file, &all_unicode, &max_depth,
+                                     &object_hook, &object_pairs_hook, &array_type,
+                                     &use_decimal, &raw_numbers))
+        return NULL;
+
+    if (max_depth <= 0) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be a positive integer");
+        return NULL;
+    }
+
+    jsondata_init(&jsondata, all_unicode, max_depth);
+
+    if (jsondata_set_options(&jsondata, object_hook, object_pairs_hook,
+                             array_type, use_decimal, raw_numbers) == -1)
+        return NULL;
+
+    opened = PyString_Check(file) || PyUnicode_Check(file);
+    if (opened) {
+        file = PyObject_CallFunction((PyObject*)&PyFile_Type, "Os", file, "rb");
+        if (file == NULL)
+            return NULL;
+    } else {
+        Py_INCREF(file);
+    }
+
+    mapping = map_file(file, &offset);
+    if (mapping != NULL) {
+        // the mapping is private, so it is decoded in place and not copied
+        // like the other objects that have only the old buffer interface
+        if (PyObject_AsReadBuffer(mapping, &data, &size) == -1) {
+            object = NULL;
+        } else {
+            jsondata.str = jsondata.ptr = (char*)data;
+            jsondata.end = jsondata.str + size;
+            // start decoding from the current position of the file object
+            if (offset > size)
+                offset = size;
+            jsondata.ptr += offset;
+            // errors only keep a copy of the input around their position
+            jsondata.owner = mapping;
+            object = decode_document(&jsondata);
+        }
+        if (object != NULL) {
+            result = PyObject_CallMethod(mapping, "close", NULL);
+            if (result == NULL)
+                Py_CLEAR(object);
+            Py_XDECREF(result);
+        } else {
+            // keep the decode error over one from closing the mapping
+            PyObject *type, *value, *tb;
+
+            PyErr_Fetch(&type, &value, &tb);
+            result = PyObject_CallMethod(mapping, "close", NULL);
+            Py_XDECREF(result);
+            PyErr_Restore(type, value, tb);
+        }
+        Py_DECREF(mapping);
+    } else {
+        read = PyObject_GetAttrString(file, "read");
+        if (read == NULL) {
+            object = NULL;
+        } else {
+            object = decode_stream(&jsondata, read);
+            Py_DECREF(read);
+        }
+    }
+
+    jsondata_free(&jsondata);
+
+    if (opened) {
+        result = PyObject_CallMethod(file, "close", NULL);
+        if (result == NULL)
+            Py_CLEAR(object);
+        Py_XDECREF(result);
+    }
+    Py_DECREF(file);
+
+    return object;
+}
+
+
+/* ---------------------------- Lazy decoding -------------------------- */
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *owner; // the object holding the JSON input
+    char *str; // the JSON input
+    char *end; // pointer to the input end
+    char *start; // the opening bracket or brace of the container
+    int all_unicode; // make all output strings unicode if true
+    Py_ssize_t max_depth; // maximum nesting depth when fully decoding
+    int indexed; // the members of the container were located
+    Py_ssize_t size; // number of members
+    Py_ssize_t allocated; // number of slots allocated in members
+    char **members; // where the value of each member starts in the input
+    char **ends; // where the value of each member ends, after the spaces
+    PyObject **values; // the member values decoded so far (NULL if not yet)
+    PyObject *keys; // maps the keys of an object to member indexes
+} LazyValue;
+
+static PyTypeObject LazyObject_Type;
+static PyTypeObject LazyArray_Type;
+
+
+// Make a lazy proxy for the array or object that starts at start
+static PyObject*
+lazy_new(PyObject *owner, char *str, char *end, char *start, int all_unicode,
+         Py_ssize_t max_depth)
+{
+    LazyValue *self;
+
+    self = PyObject_New(LazyValue, *start=='[' ? &LazyArray_Type : &LazyObject_Type);
+    if (self == NULL)
+        return NULL;
+
+    Py_INCREF(owner);
+    self->owner = owner;
+    self->str = str;
+    self->end = end;
+    self->start = start;
+    self->all_unicode = all_unicode;
+    self->max_depth = max_depth;
+    self->indexed = False;
+    self->size = self->allocated = 0;
+    self->members = NULL;
+    self->ends = NULL;
+    self->values = NULL;
+    self->keys = NULL;
+
+    return (PyObject*)self;
+}
+
+
+static void
+lazy_dealloc(LazyValue *self)
+{
+    Py_ssize_t i;
+
+    if (self->values != NULL) {
+        for (i = 0; i < self->size; i++)
+            Py_XDECREF(self->values[i]);
+        PyMem_Free(self->values);
+    }
+    PyMem_Free(self->members);
+    PyMem_Free(self->ends);
+    Py_XDECREF(self->keys);
+    Py_DECREF(self->owner);
+    PyObject_Del(self);
+}
+
+
+// Prepare a decoder for the input of the proxy, starting at ptr
+static void
+lazy_jsondata(LazyValue *self, JSONData *jsondata, char *ptr)
+{
+    jsondata_init(jsondata, self->all_unicode, self->max_depth);
+    jsondata->str = self->str;
+    jsondata->end = self->end;
+    jsondata->ptr = ptr;
+    jsondata->owner = self->owner;
+}
+
+
+static int
+lazy_add_member(LazyValue *self, char *start, char *end)
+{
+    if (self->size == self->allocated) {
+        char **members, **ends;
+        Py_ssize_t allocated;
+
+        allocated = self->allocated ? self->allocated*2 : 8;
+        if (allocated > PY_SSIZE_T_MAX / (Py_ssize_t)sizeof(char*)) {
+            members = ends = NULL;
+        } else {
+            members = PyMem_Realloc(self->members, allocated * sizeof(char*));
+            if (members != NULL)
+                self->members = members;
+            ends = PyMem_Realloc(self->ends, allocated * sizeof(char*));
+            if (ends != NULL)
+                self->ends = ends;
+        }
+        if (members == NULL || ends == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->allocated = allocated;
+    }
+    self->members[self->size] = start;
+    self->ends[self->size++] = end;
+    return 0;
+}
+
+
+/*
+ * Locate the members of the container. Only the keys of an object are decoded
+ * at this point, while the member values are skipped over and only their
+ * positions are recorded. Returns 0 on success and -1 on error.
+ */
+static int
+lazy_index(LazyValue *self)
+{
+    JSONData jsondata;
+    PyObject *key, *index;
+    int is_object, closing, result;
+    char *start;
+
+    if (self->indexed)
+        return 0;
+
+    is_object = *self->start == '{';
+    closing = is_object ? '}' : ']';
+
+    self->size = 0;
+    if (is_object) {
+        Py_CLEAR(self->keys);
+        self->keys = PyDict_New();
+        if (self->keys == NULL)
+            return -1;
+    }
+
+    lazy_jsondata(self, &jsondata, self->start + 1);
+
+    skipSpaces(&jsondata);
+    if (jsondata.ptr < jsondata.end && *jsondata.ptr == closing)
+        goto done;
+
+    while (True) {
+        skipSpaces(&jsondata);
+        if (jsondata.ptr == jsondata.end)
+            goto unterminated;
+
+        if (is_object) {
+            if (*jsondata.ptr != '"') {
+                raise_decode_error(&jsondata, position(&jsondata, jsondata.ptr),
+                                   "expecting object property name"
+                                   " at position " SSIZE_T_F,
+                                   position(&jsondata, jsondata.ptr));
+                goto failure;
+            }
+            key = decode_string(&jsondata);
+            if (key == NULL)
+                goto failure;
+            skipSpaces(&jsondata);
+            if (jsondata.ptr == jsondata.end || *jsondata.ptr != ':') {
+                raise_decode_error(&jsondata, position(&jsondata, jsondata.ptr),
+                                   "missing colon after object property name"
+                                   " at position " SSIZE_T_F,
+                                   position(&jsondata, jsondata.ptr));
+                Py_DECREF(key);
+                goto failure;
+            }
+            jsondata.ptr++;
+            skipSpaces(&jsondata);
+            if (jsondata.ptr == jsondata.end) {
+                Py_DECREF(key);
+                goto unterminated;
+            }
+            if (*jsondata.ptr==',' || *jsondata.ptr=='}') {
+                raise_decode_error(&jsondata, position(&jsondata, jsondata.ptr),
+                                   "expecting object property value"
+                                   " at position " SSIZE_T_F,
+                                   position(&jsondata, jsondata.ptr));
+                Py_DECREF(key);
+                goto failure;
+            }
+            // the last member wins when a key is duplicated
+            index = PyInt_FromSsize_t(self->size);
+            result = index ? PyDict_SetItem(self->keys, key, index) : -1;
+            Py_XDECREF(index);
+            Py_DECREF(key);
+            if (result == -1)
+                goto failure;
+        } else if (*jsondata.ptr==',' || *jsondata.ptr==']') {
+            raise_decode_error(&jsondata, position(&jsondata, jsondata.ptr),
+                               "expecting array item at position " SSIZE_T_F,
+                               position(&jsondata, jsondata.ptr));
+            goto failure;
+        }
+
+        start = jsondata.ptr;
+        if (skip_value(&jsondata) == -1)
+            goto failure;
+        skipSpaces(&jsondata);
+        if (lazy_add_member(self, start, jsondata.ptr) == -1)
+            goto failure;
+
+        if (jsondata.ptr == jsondata.end)
+            goto unterminated;
+        if (*jsondata.ptr == closing)
+            goto done;
+        if (*jsondata.ptr != ',') {
+            raise_decode_error(&jsondata, position(&jsondata, jsondata.ptr),
+                               "expecting ',' or '%c' at position " SSIZE_T_F,
+                               closing, position(&jsondata, jsondata.ptr));
+            goto failure;
+        }
+        jsondata.ptr++;
+    }
+
+done:
+    self->values = PyMem_Malloc(self->size ? self->size * sizeof(PyObject*) : 1);
+    if (self->values == NULL) {
+        PyErr_NoMemory();
+        goto failure;
+    }
+    memset(self->values, 0, self->size * sizeof(PyObject*));
+    self->indexed = True;
+    jsondata_free(&jsondata);
+    return 0;
+
+unterminated:
+    raise_decode_error(&jsondata, position(&jsondata, self->start),
+                       "unterminated %s starting at position " SSIZE_T_F,
+                       is_object ? "object" : "array",
+                       position(&jsondata, self->start));
+failure:
+    jsondata_free(&jsondata);
+    return -1;
+}
+
+
+// Get the value of a member, decoding it on first access
+static PyObject*
+lazy_member(LazyValue *self, Py_ssize_t index)
+{
+    PyObject *value;
+    JSONData jsondata;
+    char *ptr;
+
+    value = self->values[index];
+    if (value == NULL) {
+        ptr = self->members[index];
+        if (*ptr == '[' || *ptr == '{') {
+            value = lazy_new(self->owner, self->str, self->end, ptr,
+                             self->all_unicode, self->max_depth);
+        } else {
+            lazy_jsondata(self, &jsondata, ptr);
+            value = decode_json(&jsondata);
+            // skip_value only found where the member ends, so a scalar must
+            // also be checked to take up all of it, like decode would do
+            skipSpaces(&jsondata);
+            if (value != NULL && jsondata.ptr != self->ends[index]) {
+                raise_decode_error(&jsondata, position(&jsondata, jsondata.ptr),
+                                   "expecting ',' or '%c' at position " SSIZE_T_F,
+                                   *self->start=='[' ? ']' : '}',
+                                   position(&jsondata, jsondata.ptr));
+                Py_CLEAR(value);
+            }
+            jsondata_free(&jsondata);
+        }
+        if (value == NULL)
+            return NULL;
+        self->values[index] = value;
+    }
+
+    Py_INCREF(value);
+    return value;
+}
+
+
+static PyObject*
+lazy_materialize(LazyValue *self)
+{
+    PyObject *object;
+    JSONData jsondata;
+
+    lazy_jsondata(self, &jsondata, self->start);
+    object = decode_json(&jsondata);
+    jsondata_free(&jsondata);
+
+    return object;
+}
+
+
+static Py_ssize_t
+LazyObject_length(LazyValue *self)
+{
+    if (lazy_index(self) == -1)
+        return -1;
+    return PyDict_Size(self->keys);
+}
+
+
+static PyObject*
+LazyObject_subscript(LazyValue *self, PyObject *key)
+{
+    PyObject *index;
+
+    if (lazy_index(self) == -1)
+        return NULL;
+    index = PyDict_GetItem(self->keys, key);
+    if (index == NULL) {
+        if (!PyErr_Occurred())
+            PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+    return lazy_member(self, PyInt_AS_LONG(index));
+}
+
+
+static int
+LazyObject_contains(LazyValue *self, PyObject *key)
+{
+    if (lazy_index(self) == -1)
+        return -1;
+    return PyDict_Contains(self->keys, key);
+}
+
+
+static PyObject*
+LazyObject_iter(LazyValue *self)
+{
+    if (lazy_index(self) == -1)
+        return NULL;
+    return PyObject_GetIter(self->keys);
+}
+
+
+static PyObject*
+LazyObject_get(LazyValue *self, PyObject *args)
+{
+    PyObject *key, *default_value = Py_None, *index;
+
+    if (!PyArg_UnpackTuple(args, "get", 1, 2, &key, &default_value))
+        return NULL;
+
+    if (lazy_index(self) == -1)
+        return NULL;
+    index = PyDict_GetItem(self->keys, key);
+    if (index == NULL) {
+        if (PyErr_Occurred())
+            return NULL;
+        Py_INCREF(default_value);
+        return default_value;
+    }
+    return lazy_member(self, PyInt_AS_LONG(index));
+}
+
+
+static PyObject*
+LazyObject_keys(LazyValue *self)
+{
+    if (lazy_index(self) == -1)
+        return NULL;
+    return PyDict_Keys(self->keys);
+}
+
+
+// Build a list with the values (what=1) or the (key, value) pairs (what=2)
+static PyObject*
+LazyObject_list(LazyValue *self, int what)
+{
+    PyObject *list, *key, *index, *value, *item;
+    Py_ssize_t i, pos;
+
+    if (lazy_index(self) == -1)
+        return NULL;
+
+    list = PyList_New(PyDict_Size(self->keys));
+    if (list == NULL)
+        return NULL;
+
+    i = pos = 0;
+    while (PyDict_Next(self->keys, &pos, &key, &index)) {
+        value = lazy_member(self, PyInt_AS_LONG(index));
+        if (value == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        if (what == 2) {
+            item = PyTuple_Pack(2, key, value);
+            Py_DECREF(value);
+            if (item == NULL) {
+                Py_DECREF(list);
+                return NULL;
+            }
+        } else {
+            item = value;
+        }
+        PyList_SET_ITEM(list, i++, item);
+    }
+
+    return list;
+}
+
+
+static PyObject*
+LazyObject_values(LazyValue *self)
+{
+    return LazyObject_list(self, 1);
+}
+
+
+static PyObject*
+LazyObject_items(LazyValue *self)
+{
+    return LazyObject_list(self, 2);
+}
+
+
+static Py_ssize_t
+LazyArray_length(LazyValue *self)
+{
+    if (lazy_index(self) == -1)
+        return -1;
+    return self->size;
+}
+
+
+static PyObject*
+LazyArray_item(LazyValue *self, Py_ssize_t index)
+{
+    if (lazy_index(self) == -1)
+        return NULL;
+    if (index < 0 || index >= self->size) {
+        PyErr_SetString(PyExc_IndexError, "array index out of range");
+        return NULL;
+    }
+    return lazy_member(self, index);
+}
+
+
+static PyObject*
+lazy_repr(LazyValue *self)
+{
+    PyObject *object, *text, *result;
+
+    object = lazy_materialize(self);
+    if (object == NULL)
+        return NULL;
+    text = PyObject_Repr(object);
+    Py_DECREF(object);
+    if (text == NULL)
+        return NULL;
+    result = PyString_FromFormat("%s(%s)", strrchr(Py_TYPE(self)->tp_name, '.') + 1,
+                                 PyString_AS_STRING(text));
+    Py_DECREF(text);
+    return result;
+}
+
+
+#define LazyValue_Check(op) (Py_TYPE(op) == &LazyObject_Type || Py_TYPE(op) == &LazyArray_Type)
+
+// Compare the fully decoded values, so proxies compare like dictionaries and lists
+static PyObject*
+lazy_richcompare(PyObject *a, PyObject *b, int op)
+{
+    PyObject *result;
+
+    a = LazyValue_Check(a) ? lazy_materialize((LazyValue*)a) : (Py_INCREF(a), a);
+    if (a == NULL)
+        return NULL;
+    b = LazyValue_Check(b) ? lazy_materialize((LazyValue*)b) : (Py_INCREF(b), b);
+    if (b == NULL) {
+        Py_DECREF(a);
+        return NULL;
+    }
+    result = PyObject_RichCompare(a, b, op);
+    Py_DECREF(a);
+    Py_DECREF(b);
+    return result;
+}
+
+
+static PyMappingMethods LazyObject_as_mapping = {
+    (lenfunc)LazyObject_length,                 // mp_length
+    (binaryfunc)LazyObject_subscript,           // mp_subscript
+    0,                                          // mp_ass_subscript
+};
+
+static PySequenceMethods LazyObject_as_sequence = {
+    0,                                          // sq_length
+    0,                                          // sq_concat
+    0,                                          // sq_repeat
+    0,                                          // sq_item
+    0,                                          // sq_slice
+    0,                                          // sq_ass_item
+    0,                                          // sq_ass_slice
+    (objobjproc)LazyObject_contains,            // sq_contains
+};
+
+static PySequenceMethods LazyArray_as_sequence = {
+    (lenfunc)LazyArray_length,                  // sq_length
+    0,                                          // sq_concat
+    0,                                          // sq_repeat
+    (ssizeargfunc)LazyArray_item,               // sq_item
+};
+
+static PyMethodDef LazyObject_methods[] = {
+    {"get", (PyCFunction)LazyObject_get, METH_VARARGS,
+    PyDoc_STR("get(key, default=None) -> the value for key if present, else default.")},
+
+    {"keys", (PyCFunction)LazyObject_keys, METH_NOARGS,
+    PyDoc_STR("keys() -> list of the object keys.")},
+
+    {"values", (PyCFunction)LazyObject_values, METH_NOARGS,
+    PyDoc_STR("values() -> list of the object values.")},
+
+    {"items", (PyCFunction)LazyObject_items, METH_NOARGS,
+    PyDoc_STR("items() -> list of the object (key, value) pairs.")},
+
+    {"materialize", (PyCFunction)lazy_materialize, METH_NOARGS,
+    PyDoc_STR("materialize() -> fully decode the object into a dictionary.")},
+
+    {NULL, NULL}  // sentinel
+};
+
+static PyMethodDef LazyArray_methods[] = {
+    {"materialize", (PyCFunction)lazy_materialize, METH_NOARGS,
+    PyDoc_STR("materialize() -> fully decode the array into a list.")},
+
+    {NULL, NULL}  // sentinel
+};
+
+PyDoc_STRVAR(LazyObject_doc,
+"Read only mapping proxy for a JSON object returned by decode_lazy. The\n"
+"members are decoded when they are accessed for the first time."
+);
+
+PyDoc_STRVAR(LazyArray_doc,
+"Read only sequence proxy for a JSON array returned by decode_lazy. The\n"
+"items are decoded when they are accessed for the first time."
+);
+
+static PyTypeObject LazyObject_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cjson.LazyObject",                         // tp_name
+    sizeof(LazyValue),                          // tp_basicsize
+    0,                                          // tp_itemsize
+    (destructor)lazy_dealloc,                   // tp_dealloc
+    0,                                          // tp_print
+    0,                                          // tp_getattr
+    0,                                          // tp_setattr
+    0,                                          // tp_compare
+    (reprfunc)lazy_repr,                        // tp_repr
+    0,                                          // tp_as_number
+    &LazyObject_as_sequence,                    // tp_as_sequence
+    &LazyObject_as_mapping,                     // tp_as_mapping
+    0,                                          // tp_hash
+    0,                                          // tp_call
+    0,                                          // tp_str
+    0,                                          // tp_getattro
+    0,                                          // tp_setattro
+    0,                                          // tp_as_buffer
+    Py_TPFLAGS_DEFAULT,                         // tp_flags
+    LazyObject_doc,                             // tp_doc
+    0,                                          // tp_traverse
+    0,                                          // tp_clear
+    (richcmpfunc)lazy_richcompare,              // tp_richcompare
+    0,                                          // tp_weaklistoffset
+    (getiterfunc)LazyObject_iter,               // tp_iter
+    0,                                          // tp_iternext
+    LazyObject_methods,                         // tp_methods
+};
+
+static PyTypeObject LazyArray_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cjson.LazyArray",                          // tp_name
+    sizeof(LazyValue),                          // tp_basicsize
+    0,                                          // tp_itemsize
+    (destructor)lazy_dealloc,                   // tp_dealloc
+    0,                                          // tp_print
+    0,                                          // tp_getattr
+    0,                                          // tp_setattr
+    0,                                          // tp_compare
+    (reprfunc)lazy_repr,                        // tp_repr
+    0,                                          // tp_as_number
+    &LazyArray_as_sequence,                     // tp_as_sequence
+    0,                                          // tp_as_mapping
+    0,                                          // tp_hash
+    0,                                          // tp_call
+    0,                                          // tp_str
+    0,                                          // tp_getattro
+    0,                                          // tp_setattro
+    0,                                          // tp_as_buffer
+    Py_TPFLAGS_DEFAULT,                         // tp_flags
+    LazyArray_doc,                              // tp_doc
+    0,                                          // tp_traverse
+    0,                                          // tp_clear
+    (richcmpfunc)lazy_richcompare,              // tp_richcompare
+    0,                                          // tp_weaklistoffset
+    0,                                          // tp_iter
+    0,                                          // tp_iternext
+    LazyArray_methods,                          // tp_methods
+};
+
+
+/* Decode JSON representation into lazy proxies for its arrays and objects */
+
+static PyObject*
+JSON_decode_lazy(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"json", "all_unicode", "max_depth", NULL};
+    int all_unicode = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *object, *string, *owner;
+    JSONData jsondata;
+    char *start;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|in:decode_lazy", kwlist,
+                                     &string, &all_unicode, &max_depth))
+        return NULL;
+
+    if (max_depth <= 0) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be a positive integer");
+        return NULL;
+    }
+
+    jsondata_init(&jsondata, all_unicode, max_depth);
+
+    owner = jsondata_set_input(&jsondata, string);
+    if (owner == NULL)
+        return NULL;
+
+    skipSpaces(&jsondata);
+    start = jsondata.ptr;
+
+    if (start < jsondata.end && (*start == '[' || *start == '{')) {
+        // only locate the end of the value to check what follows it
+        if (skip_value(&jsondata) == -1) {
+            object = NULL;
+        } else {
+            skipSpaces(&jsondata);
+            if (jsondata.ptr < jsondata.end) {
+                raise_decode_error(&jsondata, position(&jsondata, jsondata.ptr),
+                                   "extra data after JSON description"
+                                   " at position " SSIZE_T_F,
+                                   position(&jsondata, jsondata.ptr));
+                object = NULL;
+            } else {
+                object = lazy_new(owner, jsondata.str, jsondata.end, start,
+                                  all_unicode, max_depth);
+            }
         }
-        assert(newsize - (p - PyString_AS_STRING(v)) >= 1);
-        *p++ = quote;
-        *p = '\0';
-        _PyString_Resize(&v, (int) (p - PyString_AS_STRING(v)));
-        return v;
+    } else {
+        object = decode_document(&jsondata);
     }
+
+    jsondata_free(&jsondata);
+    Py_DECREF(owner);
+
+    return object;
 }
 
+
+/* ---------------------------- JSON Pointer --------------------------- */
+
 /*
- * This function is an almost verbatim copy of unicodeescape_string() from
- * Python's unicodeobject.c with the following differences:
- *
- * - it always quotes the output using double quotes.
- * - it uses \u00hh instead of \xhh in output.
- * - it also quotes \b and \f
+ * Check if the object key at the current position matches the reference token
+ * and move past it. Keys without escapes are compared directly in the input,
+ * the others are decoded first. Returns 1 on match, 0 if the key is different
+ * and -1 with an exception set on error.
  */
-static PyObject*
-encode_unicode(PyObject *unicode)
+static int
+match_key(JSONData *jsondata, const char *token, Py_ssize_t length)
 {
-    PyObject *repr;
-    Py_UNICODE *s;
+    PyObject *key, *other;
+    StringScan scan;
+    char *quote;
+    int result;
+
+    scan.escaping = scan.has_unicode = scan.string_escape = False;
+    quote = scan_string(jsondata->ptr+1, jsondata->end, &scan);
+    if (quote == NULL) {
+        raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                           "unterminated string starting at position " SSIZE_T_F,
+                           position(jsondata, jsondata->ptr));
+        return -1;
+    }
+
+    if (memchr(jsondata->ptr+1, '\\', quote - jsondata->ptr - 1) == NULL) {
+        result = (quote - jsondata->ptr - 1 == length &&
+                  memcmp(jsondata->ptr+1, token, length) == 0);
+        jsondata->ptr = quote + 1;
+        return result;
+    }
+
+    key = decode_string(jsondata);
+    if (key == NULL)
+        return -1;
+    if (PyUnicode_Check(key))
+        other = PyUnicode_DecodeUTF8(token, length, NULL);
+    else
+        other = PyString_FromStringAndSize(token, length);
+    if (other == NULL) {
+        // a token that is not valid UTF-8 cannot match a unicode key
+        PyErr_Clear();
+        Py_DECREF(key);
+        return 0;
+    }
+    result = PyObject_RichCompareBool(key, other, Py_EQ);
+    Py_DECREF(other);
+    Py_DECREF(key);
+
+    return result;
+}
+
+
+/*
+ * Move to the value of the object member named by the reference token. The
+ * values of the other members are skipped without being decoded. Returns 1
+ * if the member was found, 0 if it is missing and -1 on error.
+ */
+static int
+pointer_member(JSONData *jsondata, const char *token, Py_ssize_t length)
+{
+    char *start = jsondata->ptr;
+    int found;
+
+    jsondata->ptr++;
+    skipSpaces(jsondata);
+    if (jsondata->ptr < jsondata->end && *jsondata->ptr == '}')
+        return 0;
+
+    while (True) {
+        skipSpaces(jsondata);
+        if (jsondata->ptr == jsondata->end)
+            goto unterminated;
+        if (*jsondata->ptr != '"') {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "expecting object property name"
+                               " at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            return -1;
+        }
+        found = match_key(jsondata, token, length);
+        if (found == -1)
+            return -1;
+        skipSpaces(jsondata);
+        if (jsondata->ptr == jsondata->end || *jsondata->ptr != ':') {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "missing colon after object property name"
+                               " at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            return -1;
+        }
+        jsondata->ptr++;
+        skipSpaces(jsondata);
+        if (found)
+            return 1;
+        if (skip_value(jsondata) == -1)
+            return -1;
+        skipSpaces(jsondata);
+        if (jsondata->ptr == jsondata->end)
+            goto unterminated;
+        if (*jsondata->ptr == '}')
+            return 0;
+        if (*jsondata->ptr != ',') {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "expecting ',' or '}' at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            return -1;
+        }
+        jsondata->ptr++;
+    }
+
+unterminated:
+    raise_decode_error(jsondata, position(jsondata, start),
+                       "unterminated object starting at position " SSIZE_T_F,
+                       position(jsondata, start));
+    return -1;
+}
+
+
+/*
+ * Move to the array item selected by the reference token, skipping over the
+ * items in front of it. Returns 1 if the item was found, 0 if the token is
+ * not a valid index or the index is out of range and -1 on error.
+ */
+static int
+pointer_item(JSONData *jsondata, const char *token, Py_ssize_t length)
+{
+    char *start = jsondata->ptr;
+    Py_ssize_t i, index;
+
+    // the index must be a decimal number without leading zeros
+    if (length == 0 || length > 18 || (token[0] == '0' && length > 1))
+        return 0;
+    for (i = 0, index = 0; i < length; i++) {
+        if (!isDigitChar(token[i]))
+            return 0;
+        index = index*10 + (token[i] - '0');
+    }
+
+    jsondata->ptr++;
+    skipSpaces(jsondata);
+    if (jsondata->ptr < jsondata->end && *jsondata->ptr == ']')
+        return 0;
+
+    for (i = 0; ; i++) {
+        skipSpaces(jsondata);
+        if (jsondata->ptr == jsondata->end)
+            goto unterminated;
+        if (i == index)
+            return 1;
+        if (skip_value(jsondata) == -1)
+            return -1;
+        skipSpaces(jsondata);
+        if (jsondata->ptr == jsondata->end)
+            goto unterminated;
+        if (*jsondata->ptr == ']')
+            return 0;
+        if (*jsondata->ptr != ',') {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "expecting ',' or ']' at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            return -1;
+        }
+        jsondata->ptr++;
+    }
+
+unterminated:
+    raise_decode_error(jsondata, position(jsondata, start),
+                       "unterminated array starting at position " SSIZE_T_F,
+                       position(jsondata, start));
+    return -1;
+}
+
+
+/*
+ * Follow the JSON Pointer (RFC 6901) from the current position to the value
+ * it refers to. Returns 1 if the value was found, 0 if it does not exist and
+ * -1 with an exception set on error.
+ */
+static int
+follow_pointer(JSONData *jsondata, const char *pointer, Py_ssize_t length)
+{
+    const char *end = pointer + length;
+    char *token;
     Py_ssize_t size;
-    char *p;
+    int found;
 
-    static const char *hexdigit = "0123456789abcdef";
-#ifdef Py_UNICODE_WIDE
-    const Py_ssize_t expandsize = 12;
-#else
-    const Py_ssize_t expandsize = 6;
-#endif
+    if (length > 0 && *pointer != '/') {
+        PyErr_SetString(PyExc_ValueError, "JSON pointer must be empty or start with '/'");
+        return -1;
+    }
 
-    /* Initial allocation is based on the longest-possible unichr
-       escape.
+    token = PyMem_Malloc(length + 1);
+    if (token == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
 
-       In wide (UTF-32) builds '\U00xxxxxx' is 10 chars per source
-       unichr, so in this case it's the longest unichr escape. In
-       narrow (UTF-16) builds this is five chars per source unichr
-       since there are two unichrs in the surrogate pair, so in narrow
-       (UTF-16) builds it's not the longest unichr escape.
+    found = 1;
+    while (pointer < end) {
+        // unescape the next reference token
+        for (size = 0, pointer++; pointer < end && *pointer != '/'; pointer++) {
+            if (*pointer == '~') {
+                if (pointer+1 < end && (pointer[1] == '0' || pointer[1] == '1')) {
+                    token[size++] = pointer[1]=='0' ? '~' : '/';
+                    pointer++;
+                } else {
+                    PyErr_SetString(PyExc_ValueError, "invalid escape sequence in JSON pointer");
+                    found = -1;
+                    break;
+                }
+            } else {
+                token[size++] = *pointer;
+            }
+        }
+        if (found == -1)
+            break;
 
-       In wide or narrow builds '\uxxxx' is 6 chars per source unichr,
-       so in the narrow (UTF-16) build case it's the longest unichr
-       escape.
-    */
+        skipSpaces(jsondata);
+        if (jsondata->ptr == jsondata->end) {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "empty JSON description");
+            found = -1;
+        } else if (*jsondata->ptr == '{') {
+            found = pointer_member(jsondata, token, size);
+        } else if (*jsondata->ptr == '[') {
+            found = pointer_item(jsondata, token, size);
+        } else {
+            // other values have no members to refer to
+            found = 0;
+        }
+        if (found != 1)
+            break;
+    }
 
-    s = PyUnicode_AS_UNICODE(unicode);
-    size = PyUnicode_GET_SIZE(unicode);
+    PyMem_Free(token);
 
-    if (size > (PY_SSIZE_T_MAX-2-1)/expandsize) {
-        PyErr_SetString(PyExc_OverflowError,
-                        "unicode object is too large to make repr");
+    return found;
+}
+
+
+/* Decode only the value a JSON Pointer refers to */
+
+static PyObject*
+JSON_get(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"json", "pointer", "default", "all_unicode", "max_depth", NULL};
+    int all_unicode = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *object, *string, *pointer, *default_value = NULL, *owner;
+    JSONData jsondata;
+    int found;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|Oin:get", kwlist,
+                                     &string, &pointer, &default_value,
+                                     &all_unicode, &max_depth))
+        return NULL;
+
+    if (max_depth <= 0) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be a positive integer");
+        return NULL;
+    }
+
+    if (PyUnicode_Check(pointer)) {
+        pointer = PyUnicode_AsUTF8String(pointer);
+        if (pointer == NULL)
+            return NULL;
+    } else if (PyString_Check(pointer)) {
+        Py_INCREF(pointer);
+    } else {
+        PyErr_Format(PyExc_TypeError, "JSON pointer must be a string, not %.200s",
+                     pointer->ob_type->tp_name);
+        return NULL;
+    }
+
+    jsondata_init(&jsondata, all_unicode, max_depth);
+
+    owner = jsondata_set_input(&jsondata, string);
+    if (owner == NULL) {
+        Py_DECREF(pointer);
         return NULL;
     }
 
-    repr = PyString_FromStringAndSize(NULL, 2 + expandsize*size + 1);
-    if (repr == NULL)
+    found = follow_pointer(&jsondata, PyString_AS_STRING(pointer),
+                           PyString_GET_SIZE(pointer));
+
+    if (found == 1) {
+        object = decode_json(&jsondata);
+    } else if (found == 0) {
+        if (default_value != NULL) {
+            Py_INCREF(default_value);
+            object = default_value;
+        } else {
+            PyErr_SetObject(PyExc_KeyError, pointer);
+            object = NULL;
+        }
+    } else {
+        object = NULL;
+    }
+
+    jsondata_free(&jsondata);
+    Py_DECREF(owner);
+    Py_DECREF(pointer);
+
+    return object;
+}
+
+
+/* -------------------------- Columnar decoding ------------------------ */
+
+/*
+ * An array of objects is decoded into one column per member name, without
+ * building the objects. The columns keep integers and floating point numbers
+ * as machine values for as long as they hold nothing else, which become
+ * array.array('l') and array.array('d') values at the end. The first value of
+ * another kind turns the column into a list.
+ */
+
+#define COLUMN_INITIAL_SIZE 64
+
+typedef enum {
+    ColumnIntegers=0,
+    ColumnReals,
+    ColumnList
+} ColumnType;
+
+typedef struct Column {
+    int type; // one of ColumnType
+    Py_ssize_t size; // number of values
+    Py_ssize_t allocated; // slots allocated in integers or reals
+    union {
+        long *integers;
+        double *reals;
+    } values;
+    PyObject *list; // the values of list columns
+} Column;
+
+typedef struct ColumnSet {
+    PyObject *keys; // the column index for every member name
+    Column *items; // the columns
+    Py_ssize_t size; // number of columns
+    Py_ssize_t allocated; // number of slots allocated in items
+} ColumnSet;
+
+
+static void
+column_free(Column *column)
+{
+    PyMem_Free(column->values.integers);
+    column->values.integers = NULL;
+    Py_CLEAR(column->list);
+}
+
+
+// Convert the column to a list holding the same values
+static int
+column_to_list(Column *column)
+{
+    PyObject *list, *item;
+    Py_ssize_t i;
+
+    if (column->type == ColumnList)
+        return 0;
+
+    list = PyList_New(column->size);
+    if (list == NULL)
+        return -1;
+    for (i = 0; i < column->size; i++) {
+        if (column->type == ColumnIntegers)
+            item = PyInt_FromLong(column->values.integers[i]);
+        else
+            item = PyFloat_FromDouble(column->values.reals[i]);
+        if (item == NULL) {
+            Py_DECREF(list);
+            return -1;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+
+    column_free(column);
+    column->type = ColumnList;
+    column->list = list;
+    return 0;
+}
+
+
+// Convert an integer column to floating point numbers, or to a list if some
+// integer cannot be converted exactly
+static int
+column_to_reals(Column *column)
+{
+    Py_ssize_t i;
+
+    for (i = 0; i < column->size; i++) {
+        if (column->values.integers[i] > MAX_EXACT_DOUBLE_INTEGER ||
+            column->values.integers[i] < -MAX_EXACT_DOUBLE_INTEGER)
+            return column_to_list(column);
+    }
+    // longs and doubles have the same size on the platforms where it matters,
+    // but the conversion must not assume so
+    if (sizeof(double) == sizeof(long)) {
+        for (i = 0; i < column->size; i++)
+            column->values.reals[i] = (double)column->values.integers[i];
+    } else {
+        double *reals;
+
+        reals = PyMem_New(double, column->allocated);
+        if (reals == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        for (i = 0; i < column->size; i++)
+            reals[i] = (double)column->values.integers[i];
+        PyMem_Free(column->values.integers);
+        column->values.reals = reals;
+    }
+    column->type = ColumnReals;
+    return 0;
+}
+
+
+// Add a value to the column, which is converted to fit it if needed
+static int
+column_append(Column *column, PyObject *value)
+{
+    long integer = 0;
+    int is_integer, is_real;
+
+    is_integer = PyInt_CheckExact(value);
+    is_real = PyFloat_CheckExact(value);
+    if (is_integer)
+        integer = PyInt_AS_LONG(value);
+
+    if (column->type == ColumnIntegers && is_real) {
+        if (column_to_reals(column) == -1)
+            return -1;
+    } else if (column->type == ColumnReals && is_integer &&
+               (integer > MAX_EXACT_DOUBLE_INTEGER || integer < -MAX_EXACT_DOUBLE_INTEGER)) {
+        if (column_to_list(column) == -1)
+            return -1;
+    } else if (column->type != ColumnList && !is_integer && !is_real) {
+        if (column_to_list(column) == -1)
+            return -1;
+    }
+
+    if (column->type == ColumnList)
+        return PyList_Append(column->list, value);
+
+    if (column->size == column->allocated) {
+        Py_ssize_t allocated;
+        void *values;
+
+        allocated = column->allocated ? column->allocated*2 : COLUMN_INITIAL_SIZE;
+        if (allocated > PY_SSIZE_T_MAX / 8)
+            values = NULL;
+        else if (column->type == ColumnIntegers)
+            values = PyMem_Resize(column->values.integers, long, allocated);
+        else
+            values = PyMem_Resize(column->values.reals, double, allocated);
+        if (values == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        column->values.integers = values;
+        column->allocated = allocated;
+    }
+
+    if (column->type == ColumnIntegers)
+        column->values.integers[column->size++] = integer;
+    else
+        column->values.reals[column->size++] = is_real ? PyFloat_AS_DOUBLE(value) : (double)integer;
+    return 0;
+}
+
+
+// Add None to the column until it has the given number of values
+static int
+column_pad(Column *column, Py_ssize_t size)
+{
+    while (column->size < size) {
+        if (column_to_list(column) == -1 || PyList_Append(column->list, Py_None) == -1)
+            return -1;
+        column->size++;
+    }
+    return 0;
+}
+
+
+// Get the column for a member name, adding it if it is new
+static Column*
+columns_get(ColumnSet *columns, PyObject *key)
+{
+    PyObject *index;
+    Column *column;
+    int type;
+
+    index = PyDict_GetItem(columns->keys, key);
+    if (index != NULL)
+        return &columns->items[PyInt_AS_LONG(index)];
+
+    if (columns->size == columns->allocated) {
+        Py_ssize_t allocated;
+        Column *items;
+
+        allocated = columns->allocated ? columns->allocated*2 : 16;
+        items = PyMem_Resize(columns->items, Column, allocated);
+        if (items == NULL) {
+            PyErr_NoMemory();
+            return NULL;
+        }
+        columns->items = items;
+        columns->allocated = allocated;
+    }
+
+    index = PyInt_FromSsize_t(columns->size);
+    if (index == NULL)
+        return NULL;
+    type = PyDict_SetItem(columns->keys, key, index);
+    Py_DECREF(index);
+    if (type == -1)
         return NULL;
 
-    p = PyString_AS_STRING(repr);
-
-    *p++ = '"';
+    column = &columns->items[columns->size++];
+    column->type = ColumnIntegers;
+    column->size = column->allocated = 0;
+    column->values.integers = NULL;
+    column->list = NULL;
+    return column;
+}
 
-    while (size-- > 0) {
-        Py_UNICODE ch = *s++;
 
-        /* Escape quotes */
-        if ((ch == (Py_UNICODE) PyString_AS_STRING(repr)[0] || ch == '\\')) {
-            *p++ = '\\';
-            *p++ = (char) ch;
-            continue;
-        }
+// Add the members of the object at the current position to the columns,
+// as the values of the given row
+static int
+decode_row(JSONData *jsondata, ColumnSet *columns, Py_ssize_t row)
+{
+    char *start = jsondata->ptr;
+    PyObject *key, *value;
+    Column *column;
+    int result;
 
-#ifdef Py_UNICODE_WIDE
-        /* Map 21-bit characters to UTF-16 surrogate pairs */
-        else if (ch >= 0x10000) {
-            unsigned short ucs1, ucs2;
-            ucs1 = (unsigned short)(((ch - 0x10000) >> 10) & 0x03FF) + 0xD800;
-            ucs2 = (unsigned short)((ch - 0x10000) & 0x03FF) + 0xDC00;
+    jsondata->ptr++;
+    skipSpaces(jsondata);
+    if (jsondata->ptr < jsondata->end && *jsondata->ptr == '}') {
+        jsondata->ptr++;
+        return 0;
+    }
 
-            *p++ = '\\';
-            *p++ = 'u';
-            *p++ = hexdigit[(ucs1 >> 12) & 0x000F];
-            *p++ = hexdigit[(ucs1 >> 8) & 0x000F];
-            *p++ = hexdigit[(ucs1 >> 4) & 0x000F];
-            *p++ = hexdigit[ucs1 & 0x000F];
-            *p++ = '\\';
-            *p++ = 'u';
-            *p++ = hexdigit[(ucs2 >> 12) & 0x000F];
-            *p++ = hexdigit[(ucs2 >> 8) & 0x000F];
-            *p++ = hexdigit[(ucs2 >> 4) & 0x000F];
-            *p++ = hexdigit[ucs2 & 0x000F];
-            continue;
+    while (True) {
+        skipSpaces(jsondata);
+        if (jsondata->ptr == jsondata->end)
+            goto unterminated;
+        if (*jsondata->ptr != '"') {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "expecting object property name"
+                               " at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            return -1;
+        }
+        key = decode_string(jsondata);
+        if (key == NULL)
+            return -1;
+        skipSpaces(jsondata);
+        if (jsondata->ptr == jsondata->end || *jsondata->ptr != ':') {
+            Py_DECREF(key);
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "missing colon after object property name"
+                               " at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            return -1;
+        }
+        jsondata->ptr++;
+        skipSpaces(jsondata);
+        if (jsondata->ptr < jsondata->end && (*jsondata->ptr==',' || *jsondata->ptr=='}')) {
+            Py_DECREF(key);
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "expecting object property value"
+                               " at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            return -1;
         }
-#endif
 
-        /* Map 16-bit characters to '\uxxxx' */
-        if (ch >= 256) {
-            *p++ = '\\';
-            *p++ = 'u';
-            *p++ = hexdigit[(ch >> 12) & 0x000F];
-            *p++ = hexdigit[(ch >> 8) & 0x000F];
-            *p++ = hexdigit[(ch >> 4) & 0x000F];
-            *p++ = hexdigit[ch & 0x000F];
+        column = columns_get(columns, key);
+        Py_DECREF(key);
+        if (column == NULL)
+            return -1;
+
+        if (jsondata->ptr < jsondata->end && isDigitChar(*jsondata->ptr))
+            value = decode_number(jsondata);
+        else
+            value = decode_json(jsondata);
+        if (value == NULL)
+            return -1;
+
+        // a repeated member replaces the value it had before in the row
+        if (column->size > row) {
+            result = 0;
+            if (column->type == ColumnList)
+                result = PyList_SetSlice(column->list, row, row+1, NULL);
+            column->size = row;
+        } else {
+            result = column_pad(column, row);
         }
+        if (result == 0)
+            result = column_append(column, value);
+        Py_DECREF(value);
+        if (result == -1)
+            return -1;
+        if (column->type == ColumnList)
+            column->size = PyList_GET_SIZE(column->list);
 
-        /* Map special whitespace to '\t', \n', '\r', '\f', '\b' */
-        else if (ch == '\t') {
-            *p++ = '\\';
-            *p++ = 't';
+        skipSpaces(jsondata);
+        if (jsondata->ptr == jsondata->end)
+            goto unterminated;
+        if (*jsondata->ptr == '}') {
+            jsondata->ptr++;
+            return 0;
         }
-        else if (ch == '\n') {
-            *p++ = '\\';
-            *p++ = 'n';
+        if (*jsondata->ptr != ',') {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "expecting ',' or '}' at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            return -1;
         }
-        else if (ch == '\r') {
-            *p++ = '\\';
-            *p++ = 'r';
+        jsondata->ptr++;
+    }
+
+unterminated:
+    raise_decode_error(jsondata, position(jsondata, start),
+                       "unterminated object starting at position " SSIZE_T_F,
+                       position(jsondata, start));
+    return -1;
+}
+
+
+// Decode the array of objects at the current position into the columns.
+// Returns the number of rows or -1 on error
+static Py_ssize_t
+decode_rows(JSONData *jsondata, ColumnSet *columns)
+{
+    char *start;
+    Py_ssize_t rows = 0;
+
+    skipSpaces(jsondata);
+    if (jsondata->ptr == jsondata->end || *jsondata->ptr != '[') {
+        raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                           "expecting array of objects at position " SSIZE_T_F,
+                           position(jsondata, jsondata->ptr));
+        return -1;
+    }
+    start = jsondata->ptr++;
+    skipSpaces(jsondata);
+    if (jsondata->ptr < jsondata->end && *jsondata->ptr == ']') {
+        jsondata->ptr++;
+        return 0;
+    }
+
+    while (True) {
+        skipSpaces(jsondata);
+        if (jsondata->ptr == jsondata->end)
+            goto unterminated;
+        if (*jsondata->ptr != '{') {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "expecting object at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            return -1;
         }
-        else if (ch == '\f') {
-            *p++ = '\\';
-            *p++ = 'f';
+        if (decode_row(jsondata, columns, rows) == -1)
+            return -1;
+        rows++;
+        skipSpaces(jsondata);
+        if (jsondata->ptr == jsondata->end)
+            goto unterminated;
+        if (*jsondata->ptr == ']') {
+            jsondata->ptr++;
+            return rows;
         }
-        else if (ch == '\b') {
-            *p++ = '\\';
-            *p++ = 'b';
+        if (*jsondata->ptr != ',') {
+            raise_decode_error(jsondata, position(jsondata, jsondata->ptr),
+                               "expecting ',' or ']' at position " SSIZE_T_F,
+                               position(jsondata, jsondata->ptr));
+            return -1;
         }
+        jsondata->ptr++;
+    }
 
-        /* Map non-printable US ASCII to '\u00hh' */
-        else if (ch < ' ' || ch >= 0x7F) {
-            *p++ = '\\';
-            *p++ = 'u';
-            *p++ = '0';
-            *p++ = '0';
-            *p++ = hexdigit[(ch >> 4) & 0x000F];
-            *p++ = hexdigit[ch & 0x000F];
-        }
+unterminated:
+    raise_decode_error(jsondata, position(jsondata, start),
+                       "unterminated array starting at position " SSIZE_T_F,
+                       position(jsondata, start));
+    return -1;
+}
 
-        /* Copy everything else as-is */
-        else
-            *p++ = (char) ch;
-    }
 
-    *p++ = PyString_AS_STRING(repr)[0];
+// Make the python value of a column with the given number of rows
+static PyObject*
+make_column(Column *column, Py_ssize_t rows)
+{
+    if (column_pad(column, rows) == -1)
+        return NULL;
 
-    *p = '\0';
-    _PyString_Resize(&repr, p - PyString_AS_STRING(repr));
-    return repr;
+    switch (column->type) {
+    case ColumnIntegers:
+        return make_typed_array("l", column->values.integers, column->size * sizeof(long));
+    case ColumnReals:
+        return make_typed_array("d", column->values.reals, column->size * sizeof(double));
+    default:
+        Py_INCREF(column->list);
+        return column->list;
+    }
 }
 
 
-/*
- * This function is an almost verbatim copy of tuplerepr() from
- * Python's tupleobject.c with the following differences:
- *
- * - it uses encode_object() to get the object's JSON reprezentation.
- * - it uses [] as decorations instead of () (to masquerade as a JSON array).
- */
+/* Decode a JSON array of objects into a dictionary of columns */
 
 static PyObject*
-encode_tuple(PyObject *tuple)
+JSON_decode_columns(PyObject *self, PyObject *args, PyObject *kwargs)
 {
-    Py_ssize_t i, n;
-    PyObject *s, *temp;
-    PyObject *pieces, *result = NULL;
-    PyTupleObject *v = (PyTupleObject*) tuple;
-
-    n = v->ob_size;
-    if (n == 0)
-        return PyString_FromString("[]");
+    static char *kwlist[] = {"json", "all_unicode", "max_depth", NULL};
+    int all_unicode = False;
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *string, *str, *result = NULL, *key, *index, *column;
+    ColumnSet columns;
+    JSONData jsondata;
+    Py_ssize_t rows, i, pos;
 
-    pieces = PyTuple_New(n);
-    if (pieces == NULL)
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|in:decode_columns", kwlist,
+                                     &string, &all_unicode, &max_depth))
         return NULL;
 
-    /* Do repr() on each element. */
-    for (i = 0; i < n; ++i) {
-        s = encode_object(v->ob_item[i]);
-        if (s == NULL)
-            goto Done;
-        PyTuple_SET_ITEM(pieces, i, s);
+    if (max_depth <= 0) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be a positive integer");
+        return NULL;
     }
 
-    /* Add "[]" decorations to the first and last items. */
-    assert(n > 0);
-    s = PyString_FromString("[");
-    if (s == NULL)
-        goto Done;
-    temp = PyTuple_GET_ITEM(pieces, 0);
-    PyString_ConcatAndDel(&s, temp);
-    PyTuple_SET_ITEM(pieces, 0, s);
-    if (s == NULL)
-        goto Done;
+    jsondata_init(&jsondata, all_unicode, max_depth);
 
-    s = PyString_FromString("]");
-    if (s == NULL)
-        goto Done;
-    temp = PyTuple_GET_ITEM(pieces, n-1);
-    PyString_ConcatAndDel(&temp, s);
-    PyTuple_SET_ITEM(pieces, n-1, temp);
-    if (temp == NULL)
-        goto Done;
+    str = jsondata_set_input(&jsondata, string);
+    if (str == NULL)
+        return NULL;
 
-    /* Paste them all together with ", " between. */
-    s = PyString_FromString(", ");
-    if (s == NULL)
-        goto Done;
-    result = _PyString_Join(s, pieces);
-    Py_DECREF(s);
+    columns.keys = PyDict_New();
+    columns.items = NULL;
+    columns.size = columns.allocated = 0;
+    if (columns.keys == NULL)
+        goto done;
+
+    rows = decode_rows(&jsondata, &columns);
+    if (rows == -1)
+        goto done;
+
+    skipSpaces(&jsondata);
+    if (jsondata.ptr < jsondata.end) {
+        raise_decode_error(&jsondata, position(&jsondata, jsondata.ptr),
+                           "extra data after JSON description"
+                           " at position " SSIZE_T_F,
+                           position(&jsondata, jsondata.ptr));
+        goto done;
+    }
+
+    result = PyDict_New();
+    if (result == NULL)
+        goto done;
+    pos = 0;
+    while (PyDict_Next(columns.keys, &pos, &key, &index)) {
+        column = make_column(&columns.items[PyInt_AS_LONG(index)], rows);
+        if (column == NULL || PyDict_SetItem(result, key, column) == -1) {
+            Py_XDECREF(column);
+            Py_CLEAR(result);
+            goto done;
+        }
+        Py_DECREF(column);
+    }
+
+done:
+    for (i = 0; i < columns.size; i++)
+        column_free(&columns.items[i]);
+    PyMem_Free(columns.items);
+    Py_XDECREF(columns.keys);
+    jsondata_free(&jsondata);
+    Py_DECREF(str);
 
-Done:
-    Py_DECREF(pieces);
     return result;
 }
 
+
+/* ----------------------------- Validation ---------------------------- */
+
 /*
- * This function is an almost verbatim copy of list_repr() from
- * Python's listobject.c with the following differences:
- *
- * - it uses encode_object() to get the object's JSON reprezentation.
- * - it doesn't use the ellipsis to represent a list with references
- *   to itself, instead it raises an exception as such lists cannot be
- *   represented in JSON.
+ * Check if a JSON representation is well-formed without decoding it. Returns 0
+ * if it is, 1 if it is not, storing the position of the error in error_pos,
+ * and -1 with an exception set if the arguments are invalid
  */
-static PyObject*
-encode_list(PyObject *list)
+static int
+check_json(PyObject *args, PyObject *kwargs, const char *format,
+           Py_ssize_t *error_pos)
 {
-    Py_ssize_t i;
-    PyObject *s, *temp;
-    PyObject *pieces = NULL, *result = NULL;
-    PyListObject *v = (PyListObject*) list;
+    static char *kwlist[] = {"json", "max_depth", NULL};
+    Py_ssize_t max_depth = DEFAULT_MAX_DEPTH;
+    PyObject *string, *owner;
+    JSONData jsondata;
+    Scanner scanner;
+    int result;
 
-    i = Py_ReprEnter((PyObject*)v);
-    if (i != 0) {
-        if (i > 0) {
-            PyErr_SetString(JSON_EncodeError, "a list with references to "
-                            "itself is not JSON encodable");
-        }
-        return NULL;
-    }
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, kwlist,
+                                     &string, &max_depth))
+        return -1;
 
-    if (v->ob_size == 0) {
-        result = PyString_FromString("[]");
-        goto Done;
+    if (max_depth <= 0) {
+        PyErr_SetString(PyExc_ValueError, "max_depth must be a positive integer");
+        return -1;
     }
 
-    pieces = PyList_New(0);
-    if (pieces == NULL)
-        goto Done;
+    jsondata_init(&jsondata, False, max_depth);
 
-    /* Do repr() on each element.  Note that this may mutate the list,
-     * so must refetch the list size on each iteration. */
-    for (i = 0; i < v->ob_size; ++i) {
-        int status;
-        s = encode_object(v->ob_item[i]);
-        if (s == NULL)
-            goto Done;
-        status = PyList_Append(pieces, s);
-        Py_DECREF(s);  /* append created a new ref */
-        if (status < 0)
-            goto Done;
+    // the owner keeps the input alive and unchanged if the GIL is released
+    owner = jsondata_set_input(&jsondata, string);
+    if (owner == NULL)
+        return -1;
+
+    scanner.str = scanner.ptr = jsondata.str;
+    scanner.end = jsondata.end;
+    scanner.max_depth = max_depth;
+    scanner.tape = NULL;
+    scanner.float_spans = scanner.integer_spans = False;
+    scanner.single_value = False;
+
+    result = scan_input(&scanner);
+
+    jsondata_free(&jsondata);
+    Py_DECREF(owner);
+
+    if (result == 0)
+        return 0;
+    if (scanner.error == OutOfMemory) {
+        PyErr_NoMemory();
+        return -1;
     }
 
-    /* Add "[]" decorations to the first and last items. */
-    assert(PyList_GET_SIZE(pieces) > 0);
-    s = PyString_FromString("[");
-    if (s == NULL)
-        goto Done;
-    temp = PyList_GET_ITEM(pieces, 0);
-    PyString_ConcatAndDel(&s, temp);
-    PyList_SET_ITEM(pieces, 0, s);
-    if (s == NULL)
-        goto Done;
+    *error_pos = scanner.error_ptr - scanner.str;
+    return 1;
+}
 
-    s = PyString_FromString("]");
-    if (s == NULL)
-        goto Done;
-    temp = PyList_GET_ITEM(pieces, PyList_GET_SIZE(pieces) - 1);
-    PyString_ConcatAndDel(&temp, s);
-    PyList_SET_ITEM(pieces, PyList_GET_SIZE(pieces) - 1, temp);
-    if (temp == NULL)
-        goto Done;
 
-    /* Paste them all together with ", " between. */
-    s = PyString_FromString(", ");
-    if (s == NULL)
-        goto Done;
-    result = _PyString_Join(s, pieces);
-    Py_DECREF(s);
+static PyObject*
+JSON_validate(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    Py_ssize_t error_pos;
+
+    switch (check_json(args, kwargs, "O|n:validate", &error_pos)) {
+    case 0:
+        return Py_BuildValue("(On)", Py_True, (Py_ssize_t)-1);
+    case 1:
+        return Py_BuildValue("(On)", Py_False, error_pos);
+    default:
+        return NULL;
+    }
+}
 
-Done:
-    Py_XDECREF(pieces);
-    Py_ReprLeave((PyObject *)v);
-    return result;
+
+// Like validate, but only tells if the input is valid, without error details
+static PyObject*
+JSON_is_valid(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    Py_ssize_t error_pos;
+    int result;
+
+    result = check_json(args, kwargs, "O|n:is_valid", &error_pos);
+    if (result == -1)
+        return NULL;
+    return PyBool_FromLong(result == 0);
 }
 
 
+/* ---------------------------- Decode errors -------------------------- */
+
 /*
- * This function is an almost verbatim copy of dict_repr() from
- * Python's dictobject.c with the following differences:
- *
- * - it uses encode_object() to get the object's JSON reprezentation.
- * - only accept strings for keys.
- * - it doesn't use the ellipsis to represent a dictionary with references
- *   to itself, instead it raises an exception as such dictionaries cannot
- *   be represented in JSON.
+ * The errors raised by raise_decode_error keep the details (format, pos,
+ * values, doc, doc_pos, input, lineno, colno) as their arguments, while the
+ * args attribute shows only the message like for the other exceptions. The
+ * message is the format filled in with the values, which is only done when it
+ * is requested. The doc is the part of the input around the error that starts
+ * at doc_pos, and pos, lineno and colno tell where the error is in the whole
+ * input. For string inputs the input is kept to find lineno and colno when
+ * they are requested, else they were found when the error was raised. The
+ * details after pos are None for streams and incremental decoding.
  */
+
+
+// Format the message of a decode error, which uses the PyErr_Format
+// conversions that format_values supports
 static PyObject*
-encode_dict(PyObject *dict)
+decode_error_message(PyObject *self)
 {
-    Py_ssize_t i;
-    PyObject *s, *temp, *colon = NULL;
-    PyObject *pieces = NULL, *result = NULL;
-    PyObject *key, *value;
-    PyDictObject *mp = (PyDictObject*) dict;
+    PyObject *format, *template, *message;
+    char *f, *ptr;
 
-    i = Py_ReprEnter((PyObject *)mp);
-    if (i != 0) {
-        if (i > 0) {
-            PyErr_SetString(JSON_EncodeError, "a dict with references to "
-                            "itself is not JSON encodable");
-        }
+    format = PyTuple_GET_ITEM(error_args(self), ErrorFormat);
+
+    // python formats do not have the size modifiers
+    template = PyString_FromStringAndSize(NULL, PyString_GET_SIZE(format));
+    if (template == NULL)
         return NULL;
+    ptr = PyString_AS_STRING(template);
+    for (f = PyString_AS_STRING(format); *f; f++) {
+        *ptr++ = *f;
+        if (*f == '%' && f[1] == 'z')
+            f++;
     }
+    _PyString_Resize(&template, ptr - PyString_AS_STRING(template));
+    if (template == NULL)
+        return NULL;
 
-    if (mp->ma_used == 0) {
-        result = PyString_FromString("{}");
-        goto Done;
+    message = PyString_Format(template, PyTuple_GET_ITEM(error_args(self), ErrorValues));
+    Py_DECREF(template);
+    return message;
+}
+
+
+/*
+ * Find the line and the column of a decode error, counting the lines of the
+ * input it keeps if they were not counted when it was raised. Returns 1 if
+ * they are known, 0 if not and -1 on error.
+ */
+static int
+decode_error_location(PyObject *self, Py_ssize_t *lineno, Py_ssize_t *colno)
+{
+    PyObject *args, *input;
+    char *str, *ptr, *line_start, *newline;
+    Py_ssize_t pos;
+
+    if (!has_error_info(self))
+        return 0;
+    args = error_args(self);
+    input = PyTuple_GET_ITEM(args, ErrorInput);
+
+    if (input == Py_None) {
+        if (PyTuple_GET_ITEM(args, ErrorLine) == Py_None)
+            return 0;
+        *lineno = PyInt_AsSsize_t(PyTuple_GET_ITEM(args, ErrorLine));
+        *colno = PyInt_AsSsize_t(PyTuple_GET_ITEM(args, ErrorColumn));
+        return PyErr_Occurred() ? -1 : 1;
     }
 
-    pieces = PyList_New(0);
-    if (pieces == NULL)
-        goto Done;
+    pos = PyInt_AsSsize_t(PyTuple_GET_ITEM(args, ErrorPosition));
+    if (pos == -1 && PyErr_Occurred())
+        return -1;
+    if (!PyString_Check(input) || pos < 0 || pos > PyString_GET_SIZE(input))
+        return 0;
+
+    str = line_start = PyString_AS_STRING(input);
+    ptr = str + pos;
+    *lineno = 1;
+    while ((newline = memchr(line_start, '\n', ptr - line_start)) != NULL) {
+        (*lineno)++;
+        line_start = newline + 1;
+    }
+    *colno = ptr - line_start + 1;
+    return 1;
+}
 
-    colon = PyString_FromString(": ");
-    if (colon == NULL)
-        goto Done;
 
-    /* Do repr() on each key+value pair, and insert ": " between them.
-     * Note that repr may mutate the dict. */
-    i = 0;
-    while (PyDict_Next((PyObject *)mp, &i, &key, &value)) {
-        int status;
+static PyObject*
+DecodeError_get_msg(PyObject *self, void *closure)
+{
+    PyObject *object;
 
-        if (!PyString_Check(key) && !PyUnicode_Check(key)) {
-            PyErr_SetString(JSON_EncodeError, "JSON encodable dictionaries "
-                            "must have string/unicode keys");
-            goto Done;
-        }
+    if (has_error_info(self))
+        return decode_error_message(self);
+    else if (PyTuple_GET_SIZE(error_args(self)) == 1)
+        object = PyTuple_GET_ITEM(error_args(self), 0);
+    else
+        object = Py_None;
+    Py_INCREF(object);
+    return object;
+}
 
-        /* Prevent repr from deleting value during key format. */
-        Py_INCREF(value);
-        s = encode_object(key);
-        PyString_Concat(&s, colon);
-        PyString_ConcatAndDel(&s, encode_object(value));
-        Py_DECREF(value);
-        if (s == NULL)
-            goto Done;
-        status = PyList_Append(pieces, s);
-        Py_DECREF(s);  /* append created a new ref */
-        if (status < 0)
-            goto Done;
+
+// The arguments are only the message, like for the errors raised by python
+static PyObject*
+DecodeError_get_args(PyObject *self, void *closure)
+{
+    PyObject *message;
+
+    if (!has_error_info(self)) {
+        Py_INCREF(error_args(self));
+        return error_args(self);
     }
+    message = decode_error_message(self);
+    if (message == NULL)
+        return NULL;
+    return Py_BuildValue("(N)", message);
+}
 
-    /* Add "{}" decorations to the first and last items. */
-    assert(PyList_GET_SIZE(pieces) > 0);
-    s = PyString_FromString("{");
-    if (s == NULL)
-        goto Done;
-    temp = PyList_GET_ITEM(pieces, 0);
-    PyString_ConcatAndDel(&s, temp);
-    PyList_SET_ITEM(pieces, 0, s);
-    if (s == NULL)
-        goto Done;
 
-    s = PyString_FromString("}");
-    if (s == NULL)
-        goto Done;
-    temp = PyList_GET_ITEM(pieces, PyList_GET_SIZE(pieces) - 1);
-    PyString_ConcatAndDel(&temp, s);
-    PyList_SET_ITEM(pieces, PyList_GET_SIZE(pieces) - 1, temp);
-    if (temp == NULL)
-        goto Done;
+static int
+DecodeError_set_args(PyObject *self, PyObject *value, void *closure)
+{
+    PyObject *args;
 
-    /* Paste them all together with ", " between. */
-    s = PyString_FromString(", ");
-    if (s == NULL)
-        goto Done;
-    result = _PyString_Join(s, pieces);
-    Py_DECREF(s);
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "args may not be deleted");
+        return -1;
+    }
+    args = PySequence_Tuple(value);
+    if (args == NULL)
+        return -1;
+    Py_DECREF(error_args(self));
+    error_args(self) = args;
+    return 0;
+}
 
-Done:
-    Py_XDECREF(pieces);
-    Py_XDECREF(colon);
-    Py_ReprLeave((PyObject *)mp);
-    return result;
+
+static PyObject*
+DecodeError_get_message(PyObject *self, void *closure)
+{
+    PyObject *message;
+
+    if (has_error_info(self))
+        return decode_error_message(self);
+    message = ((PyBaseExceptionObject*)self)->message;
+    Py_INCREF(message);
+    return message;
+}
+
+
+static int
+DecodeError_set_message(PyObject *self, PyObject *value, void *closure)
+{
+    PyObject **message = &((PyBaseExceptionObject*)self)->message;
+
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "message may not be deleted");
+        return -1;
+    }
+    Py_INCREF(value);
+    Py_DECREF(*message);
+    *message = value;
+    return 0;
 }
 
 
 static PyObject*
-encode_object(PyObject *object)
+DecodeError_get_location(PyObject *self, void *closure)
 {
-    if (object == Py_True) {
-        return PyString_FromString("true");
-    } else if (object == Py_False) {
-        return PyString_FromString("false");
-    } else if (object == Py_None) {
-        return PyString_FromString("null");
-    } else if (PyString_Check(object)) {
-        return encode_string(object);
-    } else if (PyUnicode_Check(object)) {
-        return encode_unicode(object);
-    } else if (PyFloat_Check(object)) {
-        double val = PyFloat_AS_DOUBLE(object);
-        if (Py_IS_NAN(val)) {
-            return PyString_FromString("NaN");
-        } else if (Py_IS_INFINITY(val)) {
-            if (val > 0) {
-                return PyString_FromString("Infinity");
-            } else {
-                return PyString_FromString("-Infinity");
-            }
-        } else {
-            return PyObject_Repr(object);
-        }
-    } else if (PyInt_Check(object) || PyLong_Check(object)) {
-        return PyObject_Str(object);
-    } else if (PyList_Check(object)) {
-        PyObject *result;
-        if (Py_EnterRecursiveCall(" while encoding a JSON array from a Python list"))
-            return NULL;
-        result = encode_list(object);
-        Py_LeaveRecursiveCall();
-        return result;
-    } else if (PyTuple_Check(object)) {
-        PyObject *result;
-        if (Py_EnterRecursiveCall(" while encoding a JSON array from a Python tuple"))
-            return NULL;
-        result = encode_tuple(object);
-        Py_LeaveRecursiveCall();
-        return result;
-    } else if (PyDict_Check(object)) { // use PyMapping_Check(object) instead? -Dan
-        PyObject *result;
-        if (Py_EnterRecursiveCall(" while encoding a JSON object"))
-            return NULL;
-        result = encode_dict(object);
-        Py_LeaveRecursiveCall();
-        return result;
-    } else {
-        PyErr_SetString(JSON_EncodeError, "object is not JSON encodable");
+    Py_ssize_t lineno, colno;
+
+    switch (decode_error_location(self, &lineno, &colno)) {
+    case -1:
         return NULL;
+    case 0:
+        Py_INCREF(Py_None);
+        return Py_None;
+    default:
+        return PyInt_FromSsize_t(closure == (void*)ErrorLine ? lineno : colno);
     }
 }
 
 
-/* Encode object into its JSON representation */
+static PyObject*
+DecodeError_get_arg(PyObject *self, void *closure)
+{
+    PyObject *object;
+
+    if (has_error_info(self))
+        object = PyTuple_GET_ITEM(error_args(self), (Py_ssize_t)closure);
+    else
+        object = Py_None;
+    Py_INCREF(object);
+    return object;
+}
 
+
+// The text of the line around the error position, from the input kept
 static PyObject*
-JSON_encode(PyObject *self, PyObject *object)
+DecodeError_get_excerpt(PyObject *self, void *closure)
 {
-    return encode_object(object);
+    PyObject *doc;
+    Py_ssize_t pos, doc_pos, lineno, colno, start, end;
+    const char *data;
+
+    switch (decode_error_location(self, &lineno, &colno)) {
+    case -1:
+        return NULL;
+    case 0:
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    doc = PyTuple_GET_ITEM(error_args(self), ErrorDocument);
+    pos = PyInt_AsSsize_t(PyTuple_GET_ITEM(error_args(self), ErrorPosition));
+    doc_pos = PyInt_AsSsize_t(PyTuple_GET_ITEM(error_args(self), ErrorDocumentPosition));
+    if (PyErr_Occurred())
+        return NULL;
+    if (!PyString_Check(doc) || pos < doc_pos || pos > doc_pos + PyString_GET_SIZE(doc)) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    // positions in the kept part of the input
+    data = PyString_AS_STRING(doc);
+    pos -= doc_pos;
+    start = pos - (colno - 1);
+    if (start < 0)
+        start = 0;
+    if (start < pos - EXCERPT_LENGTH)
+        start = pos - EXCERPT_LENGTH;
+    end = pos;
+    while (end < PyString_GET_SIZE(doc) && end < pos + EXCERPT_LENGTH && data[end] != '\n')
+        end++;
+    return PyString_FromStringAndSize(data + start, end - start);
 }
 
 
-/* Decode JSON representation into pyhton objects */
+static PyObject*
+DecodeError_str(PyObject *self, PyObject *unused)
+{
+    if (has_error_info(self))
+        return decode_error_message(self);
+    return ((PyTypeObject*)PyExc_BaseException)->tp_str(self);
+}
+
 
 static PyObject*
-JSON_decode(PyObject *self, PyObject *args, PyObject *kwargs)
+DecodeError_unicode(PyObject *self, PyObject *unused)
 {
-    static char *kwlist[] = {"json", "all_unicode", NULL};
-    int all_unicode = False; // by default return unicode only when needed
-    PyObject *object, *string, *str;
-    JSONData jsondata;
+    PyObject *message, *result;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|i:decode", kwlist,
-                                     &string, &all_unicode))
+    if (!has_error_info(self))
+        return PyObject_CallMethod(PyExc_BaseException, "__unicode__", "O", self);
+    message = decode_error_message(self);
+    if (message == NULL)
         return NULL;
+    result = PyObject_Unicode(message);
+    Py_DECREF(message);
+    return result;
+}
 
-    if (PyUnicode_Check(string)) {
-        str = PyUnicode_AsRawUnicodeEscapeString(string);
-        if (str == NULL) {
-            return NULL;
-        }
-    } else {
-        Py_INCREF(string);
-        str = string;
-    }
 
-    if (PyString_AsStringAndSize(str, &(jsondata.str), NULL) == -1) {
-        Py_DECREF(str);
-        return NULL; // not a string object or it contains null bytes
-    }
+// Show only the message, like the exceptions that have a single argument
+static PyObject*
+DecodeError_repr(PyObject *self, PyObject *unused)
+{
+    PyObject *message, *repr, *result;
+    const char *name, *dot;
 
-    jsondata.ptr = jsondata.str;
-    jsondata.end = jsondata.str + PyString_GET_SIZE(str);
-    jsondata.all_unicode = all_unicode;
+    if (!has_error_info(self))
+        return ((PyTypeObject*)PyExc_BaseException)->tp_repr(self);
 
-    object = decode_json(&jsondata);
+    message = decode_error_message(self);
+    if (message == NULL)
+        return NULL;
+    repr = PyObject_Repr(message);
+    Py_DECREF(message);
+    if (repr == NULL)
+        return NULL;
+    name = Py_TYPE(self)->tp_name;
+    dot = strrchr(name, '.');
+    result = PyString_FromFormat("%s(%s,)", dot ? dot+1 : name,
+                                 PyString_AS_STRING(repr));
+    Py_DECREF(repr);
+    return result;
+}
 
-    if (object != NULL) {
-        skipSpaces(&jsondata);
-        if (jsondata.ptr < jsondata.end) {
-            PyErr_Format(JSON_DecodeError, "extra data after JSON description"
-                         " at position " SSIZE_T_F,
-                         (Py_ssize_t)(jsondata.ptr - jsondata.str));
-            Py_DECREF(str);
-            Py_DECREF(object);
-            return NULL;
-        }
-    }
 
-    Py_DECREF(str);
+static PyMethodDef DecodeError_methods[] = {
+    {"__str__", (PyCFunction)DecodeError_str, METH_NOARGS, NULL},
+    {"__unicode__", (PyCFunction)DecodeError_unicode, METH_NOARGS, NULL},
+    {"__repr__", (PyCFunction)DecodeError_repr, METH_NOARGS, NULL},
+    {NULL, NULL}  // sentinel
+};
 
-    return object;
+
+static PyGetSetDef DecodeError_getset[] = {
+    {"args", DecodeError_get_args, DecodeError_set_args,
+     "the message of the error as a tuple", NULL},
+    {"message", DecodeError_get_message, DecodeError_set_message,
+     "the error message", NULL},
+    {"msg", DecodeError_get_msg, NULL,
+     "the error message", NULL},
+    {"pos", DecodeError_get_arg, NULL,
+     "the position of the error in the input or None", (void*)ErrorPosition},
+    {"doc", DecodeError_get_arg, NULL,
+     "the part of the input around the error or None", (void*)ErrorDocument},
+    {"doc_pos", DecodeError_get_arg, NULL,
+     "the position of doc in the input or None", (void*)ErrorDocumentPosition},
+    {"lineno", DecodeError_get_location, NULL,
+     "the line number of the error (starting from 1) or None", (void*)ErrorLine},
+    {"colno", DecodeError_get_location, NULL,
+     "the column number of the error (starting from 1) or None", (void*)ErrorColumn},
+    {"excerpt", DecodeError_get_excerpt, NULL,
+     "the text of the line around the error or None", NULL},
+    {NULL}  // sentinel
+};
+
+
+// Add the methods and the descriptors above to the DecodeError class
+static int
+init_decode_error(PyTypeObject *type)
+{
+    PyMethodDef *method;
+    PyGetSetDef *getset;
+    PyObject *descr;
+    int result;
+
+    for (method = DecodeError_methods; method->ml_name != NULL; method++) {
+        descr = PyDescr_NewMethod(type, method);
+        if (descr == NULL)
+            return -1;
+        result = PyObject_SetAttrString((PyObject*)type, method->ml_name, descr);
+        Py_DECREF(descr);
+        if (result == -1)
+            return -1;
+    }
+    for (getset = DecodeError_getset; getset->name != NULL; getset++) {
+        descr = PyDescr_NewGetSet(type, getset);
+        if (descr == NULL)
+            return -1;
+        result = PyObject_SetAttrString((PyObject*)type, getset->name, descr);
+        Py_DECREF(descr);
+        if (result == -1)
+            return -1;
+    }
+    return 0;
 }
 
 
@@ -1163,12 +7549,148 @@ static PyMethodDef cjson_methods[] = {
     PyDoc_STR("encode(object) -> generate the JSON representation for object.")},
 
     {"decode", (PyCFunction)JSON_decode,  METH_VARARGS|METH_KEYWORDS,
-    PyDoc_STR("decode(string, all_unicode=False) -> parse the JSON representation into\n"
-              "python objects. The optional argument `all_unicode', specifies how to\n"
-              "convert the strings in the JSON representation into python objects.\n"
-              "If it is False (default), it will return strings everywhere possible\n"
-              "and unicode objects only where necessary, else it will return unicode\n"
-              "objects everywhere (this is slower).")},
+    PyDoc_STR("decode(string, all_unicode=False, max_depth=" string(DEFAULT_MAX_DEPTH) ", fields=None,\n"
+              "object_hook=None, object_pairs_hook=None, array_type=list,\n"
+              "use_decimal=False, raw_numbers=False, numeric_arrays=False)\n"
+              "-> parse the JSON representation into python objects. The optional\n"
+              "argument `all_unicode', specifies how to convert the strings in the JSON\n"
+              "representation into python objects. If it is False (default), it will\n"
+              "return strings everywhere possible and unicode objects only where\n"
+              "necessary, else it will return unicode objects everywhere (this is\n"
+              "slower). The optional argument `max_depth' limits how deeply arrays and\n"
+              "objects can be nested.\n"
+              "The optional argument `fields' is a collection of key paths like \"id\",\n"
+              "\"user.name\" or \"items[*].sku\", where [*] stands for all the items of\n"
+              "an array. When given, only the selected members of the objects on these\n"
+              "paths are decoded and the other members are skipped and left out.\n"
+              "The optional argument `object_hook' is called with every decoded object\n"
+              "and its result is used instead of the dictionary.\n"
+              "The optional argument `object_pairs_hook' is called instead with a tuple\n"
+              "of the (key, value) pairs of every object in document order, without\n"
+              "building a dictionary. It takes priority over object_hook.\n"
+              "The optional argument `array_type' is either list (default) or tuple and\n"
+              "specifies how arrays are decoded.\n"
+              "If the optional argument `use_decimal' is True, numbers with a fraction\n"
+              "or an exponent are decoded as decimal.Decimal instead of float, which\n"
+              "preserves their exact value.\n"
+              "If the optional argument `raw_numbers' is True, all numbers are decoded\n"
+              "as RawNumber objects that keep their text, which encode writes back\n"
+              "unchanged.\n"
+              "If the optional argument `numeric_arrays' is True, the non-empty arrays\n"
+              "whose items are all numbers are decoded as array.array('l') when the\n"
+              "items are integers that fit in a C long and as array.array('d') when some\n"
+              "are floating point numbers and the integers among them convert exactly,\n"
+              "without making an object for every item. It cannot be used with\n"
+              "use_decimal or raw_numbers.")},
+
+    {"decode_into", (PyCFunction)JSON_decode_into,  METH_VARARGS|METH_KEYWORDS,
+    PyDoc_STR("decode_into(string, buffer, max_depth=" string(DEFAULT_MAX_DEPTH) ") -> decode a JSON array of\n"
+              "numbers into the writable buffer and return the number of items, without\n"
+              "making python objects for them. The buffer must hold C longs or doubles\n"
+              "and have room for all the items, like array.array('l') or\n"
+              "array.array('d'). Its contents after the decoded items are left as they\n"
+              "were. Only integers that fit can be stored in a buffer of longs and only\n"
+              "integers that convert exactly in a buffer of doubles, otherwise a\n"
+              "ValueError is raised and the buffer is left unchanged.")},
+
+    {"decode_lines", (PyCFunction)JSON_decode_lines,  METH_VARARGS|METH_KEYWORDS,
+    PyDoc_STR("decode_lines(string, all_unicode=False, max_depth=" string(DEFAULT_MAX_DEPTH) ", errors='strict',\n"
+              "fields=None, object_hook=None, object_pairs_hook=None, array_type=list,\n"
+              "use_decimal=False, raw_numbers=False, workers=1)\n"
+              "-> parse newline delimited JSON representations (JSON Lines) into a list\n"
+              "of python objects. Blank lines are skipped. The optional argument\n"
+              "`errors' specifies what to do with the lines that cannot be decoded:\n"
+              "'strict' (default) raises a DecodeError that includes the line number,\n"
+              "'ignore' skips them and 'replace' puts the DecodeError in the list in\n"
+              "place of the value. With workers greater than 1, large inputs are split\n"
+              "into chunks of lines that are scanned by that many threads in parallel\n"
+              "without holding the GIL, before the objects are built in order. This\n"
+              "is not done when fields is given. The other arguments have the same\n"
+              "meaning as for decode.")},
+
+    {"decode_file", (PyCFunction)JSON_decode_file,  METH_VARARGS|METH_KEYWORDS,
+    PyDoc_STR("decode_file(file, all_unicode=False, max_depth=" string(DEFAULT_MAX_DEPTH) ", object_hook=None,\n"
+              "object_pairs_hook=None, array_type=list, use_decimal=False,\n"
+              "raw_numbers=False) -> parse the JSON representation stored in a file\n"
+              "into python objects. The file is either a path or a file object, which\n"
+              "is decoded starting from its current position. Regular files are memory\n"
+              "mapped instead of being read, while other files and file like objects\n"
+              "are read in chunks as needed. The other arguments have the same meaning\n"
+              "as for decode.")},
+
+    {"decode_columns", (PyCFunction)JSON_decode_columns,  METH_VARARGS|METH_KEYWORDS,
+    PyDoc_STR("decode_columns(string, all_unicode=False, max_depth=" string(DEFAULT_MAX_DEPTH) ") -> decode a JSON\n"
+              "array of objects into a dictionary with a column for every member name,\n"
+              "without building the objects. Columns of integers that fit in a C long\n"
+              "are returned as array.array('l') and columns of numbers with at least a\n"
+              "floating point one as array.array('d'), while the other columns are\n"
+              "lists. The rows that lack a member have None in its column, which makes\n"
+              "it a list. The other arguments have the same meaning as for decode.")},
+
+    {"validate", (PyCFunction)JSON_validate,  METH_VARARGS|METH_KEYWORDS,
+    PyDoc_STR("validate(string, max_depth=" string(DEFAULT_MAX_DEPTH) ") -> check if the JSON representation is\n"
+              "well-formed, following the same rules as decode. It returns a (valid,\n"
+              "error_pos) tuple, which is (True, -1) if it is and (False, position)\n"
+              "with the position where the first error was found otherwise. As an\n"
+              "error can be at position 0, test the first item rather than the\n"
+              "position. No python objects are created and the GIL is released while\n"
+              "checking large inputs, so other threads can run in the meantime.")},
+
+    {"is_valid", (PyCFunction)JSON_is_valid,  METH_VARARGS|METH_KEYWORDS,
+    PyDoc_STR("is_valid(string, max_depth=" string(DEFAULT_MAX_DEPTH) ") -> return True if the JSON\n"
+              "representation is well-formed and False otherwise, like validate but\n"
+              "without reporting where the error is.")},
+
+    {"get", (PyCFunction)JSON_get,  METH_VARARGS|METH_KEYWORDS,
+    PyDoc_STR("get(string, pointer[, default], all_unicode=False, max_depth=" string(DEFAULT_MAX_DEPTH) ") -> decode\n"
+              "only the value that the JSON Pointer (RFC 6901) refers to, for example\n"
+              "\"/data/items/3/price\". The values that are not on the path are skipped\n"
+              "without being decoded. If an object has more members with the same name\n"
+              "the first one is used. If the value does not exist, default is returned\n"
+              "when given, otherwise KeyError is raised. The other arguments have the\n"
+              "same meaning as for decode.")},
+
+    {"decode_lazy", (PyCFunction)JSON_decode_lazy,  METH_VARARGS|METH_KEYWORDS,
+    PyDoc_STR("decode_lazy(string, all_unicode=False, max_depth=" string(DEFAULT_MAX_DEPTH) ") -> parse the JSON\n"
+              "representation into lazy proxies. Arrays and objects are returned as\n"
+              "read only LazyArray and LazyObject proxies that keep a reference to the\n"
+              "input and decode their members only when they are accessed, so the\n"
+              "parts of the document that are never used are not decoded at all.\n"
+              "Errors inside a member are only detected when it is accessed. Use the\n"
+              "materialize() method of a proxy to fully decode it. The arguments have\n"
+              "the same meaning as for decode.")},
+
+    {"raw_decode", (PyCFunction)JSON_raw_decode,  METH_VARARGS|METH_KEYWORDS,
+    PyDoc_STR("raw_decode(string, start=0, all_unicode=False, max_depth=" string(DEFAULT_MAX_DEPTH) ", object_hook=None,\n"
+              "object_pairs_hook=None, array_type=list, use_decimal=False,\n"
+              "raw_numbers=False) -> decode the JSON representation that begins at\n"
+              "position start of the input, ignoring any data that follows it, and\n"
+              "return a (value, end) tuple where end is the position right after the\n"
+              "decoded representation. Strings and new style buffers are not copied,\n"
+              "so this is suitable for walking a large buffer of concatenated\n"
+              "representations. Unicode input is not accepted, as its positions would\n"
+              "not be those of the encoding the decoder reads; decode_all iterates over\n"
+              "its representations instead. The other arguments have the same meaning\n"
+              "as for decode.")},
+
+    {"decode_all", (PyCFunction)JSON_decode_all,  METH_VARARGS|METH_KEYWORDS,
+    PyDoc_STR("decode_all(string, all_unicode=False, max_depth=" string(DEFAULT_MAX_DEPTH) ", object_hook=None,\n"
+              "object_pairs_hook=None, array_type=list, use_decimal=False,\n"
+              "raw_numbers=False) -> iterate over the JSON representations that follow\n"
+              "each other in the input, like {...}{...} or values separated by\n"
+              "whitespace, decoding each one when it is requested. The iteration stops\n"
+              "after the first error. The other arguments have the same meaning as for\n"
+              "decode.")},
+
+    {"events", (PyCFunction)JSON_events,  METH_VARARGS|METH_KEYWORDS,
+    PyDoc_STR("events(json, all_unicode=False, max_depth=" string(DEFAULT_MAX_DEPTH) ") -> iterate over the\n"
+              "parsing events of the JSON representation without building the decoded\n"
+              "value. The json argument is either a string or a file like object that\n"
+              "will be read in chunks. Each event is an (event, value) tuple, where\n"
+              "event is one of start_map, map_key, end_map, start_array, end_array,\n"
+              "string, number, boolean and null. The value is the decoded key or\n"
+              "scalar for map_key and the scalar events and None for the others.\n"
+              "The other arguments have the same meaning as for decode.")},
 
     {NULL, NULL}  // sentinel
 };
@@ -1183,6 +7705,7 @@ PyMODINIT_FUNC
 initcjson(void)
 {
     PyObject *m;
+    int i;
 
     m = Py_InitModule3("cjson", cjson_methods, module_doc);
 
@@ -1204,9 +7727,50 @@ initcjson(void)
     JSON_DecodeError = PyErr_NewException("cjson.DecodeError", JSON_Error, NULL);
     if (JSON_DecodeError == NULL)
         return;
+    if (init_decode_error((PyTypeObject*)JSON_DecodeError) == -1)
+        return;
     Py_INCREF(JSON_DecodeError);
     PyModule_AddObject(m, "DecodeError", JSON_DecodeError);
 
+    if (PyType_Ready(&IncrementalDecoder_Type) < 0)
+        return;
+    if (PyType_Ready(&EventIterator_Type) < 0)
+        return;
+    if (PyType_Ready(&DocumentIterator_Type) < 0)
+        return;
+    if (PyType_Ready(&RawNumber_Type) < 0)
+        return;
+    if (PyType_Ready(&RawJSON_Type) < 0)
+        return;
+    if (PyType_Ready(&LazyObject_Type) < 0)
+        return;
+    if (PyType_Ready(&LazyArray_Type) < 0)
+        return;
+    Py_INCREF(&IncrementalDecoder_Type);
+    PyModule_AddObject(m, "IncrementalDecoder", (PyObject*)&IncrementalDecoder_Type);
+    Py_INCREF(&RawNumber_Type);
+    PyModule_AddObject(m, "RawNumber", (PyObject*)&RawNumber_Type);
+    Py_INCREF(&RawJSON_Type);
+    PyModule_AddObject(m, "RawJSON", (PyObject*)&RawJSON_Type);
+    Py_INCREF(&LazyObject_Type);
+    PyModule_AddObject(m, "LazyObject", (PyObject*)&LazyObject_Type);
+    Py_INCREF(&LazyArray_Type);
+    PyModule_AddObject(m, "LazyArray", (PyObject*)&LazyArray_Type);
+
+    event_names[StartMapEvent] = PyString_InternFromString("start_map");
+    event_names[MapKeyEvent] = PyString_InternFromString("map_key");
+    event_names[EndMapEvent] = PyString_InternFromString("end_map");
+    event_names[StartArrayEvent] = PyString_InternFromString("start_array");
+    event_names[EndArrayEvent] = PyString_InternFromString("end_array");
+    event_names[StringEvent] = PyString_InternFromString("string");
+    event_names[NumberEvent] = PyString_InternFromString("number");
+    event_names[BooleanEvent] = PyString_InternFromString("boolean");
+    event_names[NullEvent] = PyString_InternFromString("null");
+    for (i = 0; i < EventCount; i++) {
+        if (event_names[i] == NULL)
+            return;
+    }
+
     // Module version (the MODULE_VERSION macro is defined by setup.py)
     PyModule_AddStringConstant(m, "__version__", string(MODULE_VERSION));
 
@@ -20,7 +20,11 @@
 ## License along with this library; if not, write to the Free Software
 ## Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
+import os
+import decimal
 import unittest
+import StringIO
+import tempfile
 
 import cjson
 _exception = cjson.DecodeError
@@ -315,6 +319,558 @@ class JsonTest(unittest.TestCase):
         obj = cjson.decode('{"test": [3, 4, 5] }')
         self.assertEqual({"test":[3, 4, 5]}, obj)
 
+    def testReadLargeArray(self):
+        items = range(1000)
+        obj = cjson.decode('[' + ', '.join(str(i) for i in items) + ']')
+        self.assertEqual(items, obj)
+
+    def testReadNestedArrays(self):
+        obj = cjson.decode('[[], [1, [2, [3, []]]], [4, 5], 6]')
+        self.assertEqual([[], [1, [2, [3, []]]], [4, 5], 6], obj)
+
+    def testReadLargeObject(self):
+        members = dict(('key%d' % i, i) for i in range(500))
+        obj = cjson.decode(cjson.encode(members))
+        self.assertEqual(members, obj)
+
+    def testReadObjectWithDuplicateKeys(self):
+        obj = cjson.decode('{"a": 1, "b": 2, "a": 3}')
+        self.assertEqual({"a": 3, "b": 2}, obj)
+
+    def testReadDeeplyNestedArrays(self):
+        depth = 5000
+        obj = cjson.decode('[' * depth + ']' * depth)
+        for i in range(depth - 1):
+            self.assertEqual(1, len(obj))
+            obj = obj[0]
+        self.assertEqual([], obj)
+
+    def testReadMaxDepth(self):
+        self.assertEqual([{"a": []}], cjson.decode('[{"a": []}]', max_depth=3))
+        self.assertRaises(_exception, self.doReadMaxDepth)
+
+    def doReadMaxDepth(self):
+        cjson.decode('[{"a": []}]', max_depth=2)
+
+    def testReadBadMaxDepth(self):
+        self.assertRaises(ValueError, cjson.decode, '[]', max_depth=0)
+
+    def testIncrementalDecode(self):
+        decoder = cjson.IncrementalDecoder()
+        self.assertEqual([], decoder.feed('{"name": "Pat'))
+        self.assertEqual([], decoder.feed('rick", "age": 4'))
+        self.assertEqual([{"name": "Patrick", "age": 44}], decoder.feed('4}  [tr'))
+        self.assertEqual([[True, None], -1.5], decoder.feed('ue, null]-1.5 '))
+        self.assertEqual([], decoder.feed('12'))
+        self.assertEqual([12], decoder.close())
+
+    def testIncrementalDecodeByteByByte(self):
+        src = '[{"a": "x\\"y\\u1234"}, 12.5e3, false, null, -Infinity] 7 "z"'
+        decoder = cjson.IncrementalDecoder()
+        values = []
+        for c in src:
+            values.extend(decoder.feed(c))
+        values.extend(decoder.close())
+        self.assertEqual([cjson.decode(src[:-6]), 7, "z"], values)
+
+    def testIncrementalDecodeUnterminated(self):
+        self.assertRaises(_exception, self.doIncrementalDecodeUnterminated)
+
+    def doIncrementalDecodeUnterminated(self):
+        decoder = cjson.IncrementalDecoder()
+        decoder.feed('[1, 2')
+        decoder.close()
+
+    def testEvents(self):
+        events = list(cjson.events('{"a": [1, 2.5, "x"], "b": {"c": [true, null]}}'))
+        self.assertEqual([('start_map', None), ('map_key', 'a'),
+                          ('start_array', None), ('number', 1), ('number', 2.5),
+                          ('string', 'x'), ('end_array', None), ('map_key', 'b'),
+                          ('start_map', None), ('map_key', 'c'),
+                          ('start_array', None), ('boolean', True), ('null', None),
+                          ('end_array', None), ('end_map', None), ('end_map', None)],
+                         events)
+
+    def testEventsFromStream(self):
+        src = '[{"name": "Patrick", "age": 44}, [3, 4, 5], "used"] '
+        self.assertEqual(list(cjson.events(src)),
+                         list(cjson.events(StringIO.StringIO(src))))
+
+    def testEventsExtraData(self):
+        self.assertRaises(_exception, self.doEventsExtraData)
+
+    def doEventsExtraData(self):
+        list(cjson.events('[1, 2] 3'))
+
+    def testDecodeLines(self):
+        src = '{"name": "Patrick"}\n\n[1, 2, 3]  \r\n"used"\n44'
+        self.assertEqual([{"name": "Patrick"}, [1, 2, 3], "used", 44],
+                         cjson.decode_lines(src))
+        self.assertEqual([], cjson.decode_lines(''))
+
+    def testDecodeLinesBadLine(self):
+        self.assertRaises(_exception, self.doDecodeLinesBadLine)
+
+    def doDecodeLinesBadLine(self):
+        cjson.decode_lines('[1]\n[1 2]\n[3]')
+
+    def testDecodeLinesErrors(self):
+        src = '[1]\n[1 2]\n[3] 4\n[5]'
+        self.assertEqual([[1], [5]], cjson.decode_lines(src, errors='ignore'))
+        values = cjson.decode_lines(src, errors='replace')
+        self.assertEqual(4, len(values))
+        self.assert_(isinstance(values[1], cjson.DecodeError))
+        self.assert_(str(values[2]).endswith('on line 3'))
+
+    def testReadFromBuffers(self):
+        self.assertEqual([1, {"a": "b"}], cjson.decode(bytearray('[1, {"a": "b"}]')))
+        self.assertEqual([1, 2], cjson.decode(memoryview('[1, 2] extra')[:6]))
+        self.assertEqual(123, cjson.decode(memoryview('123456')[:3]))
+        self.assertEqual([3], cjson.decode(buffer('[1][3]', 3)))
+
+    def testReadTruncatedBuffer(self):
+        self.assertRaises(_exception, self.doReadTruncatedBuffer)
+
+    def doReadTruncatedBuffer(self):
+        cjson.decode(memoryview('"abc"')[:4])
+
+    def testReadNullByteInString(self):
+        self.assertEqual("a\0b", cjson.decode('"a\0b"'))
+
+    def testDecodeFile(self):
+        src = '{"name": "Patrick", "children": [1, 2, 3]}\n'
+        fd, path = tempfile.mkstemp()
+        try:
+            os.write(fd, src)
+            os.close(fd)
+            self.assertEqual(cjson.decode(src), cjson.decode_file(path))
+            f = open(path, 'rb')
+            try:
+                self.assertEqual(cjson.decode(src), cjson.decode_file(f))
+            finally:
+                f.close()
+        finally:
+            os.unlink(path)
+
+    def testDecodeFileFromStream(self):
+        src = '[{"name": "Patrick"}, "' + 'x' * 100000 + '", 44]'
+        self.assertEqual(cjson.decode(src), cjson.decode_file(StringIO.StringIO(src)))
+
+    def testDecodeFileExtraData(self):
+        self.assertRaises(_exception, self.doDecodeFileExtraData)
+
+    def doDecodeFileExtraData(self):
+        cjson.decode_file(StringIO.StringIO('[1, 2] 3'))
+
+    def testDecodeLazyObject(self):
+        obj = cjson.decode_lazy('{"id": 7, "user": {"name": "Pat", "tags": ["a", "b"]}, "bad": [1 2]}')
+        self.assertEqual(type(obj), cjson.LazyObject)
+        self.assertEqual(sorted(obj.keys()), ["bad", "id", "user"])
+        self.assertEqual(obj["id"], 7)
+        self.assertEqual(obj["user"]["name"], "Pat")
+        self.assertEqual(obj["user"]["tags"].materialize(), ["a", "b"])
+        self.assertEqual(obj.get("missing", 5), 5)
+        self.assertRaises(KeyError, lambda: obj["missing"])
+        self.assertRaises(cjson.DecodeError, lambda: obj["bad"][0])
+
+    def testDecodeLazyArray(self):
+        arr = cjson.decode_lazy(' [1, "two", [3], {"four": 4}] ')
+        self.assertEqual(type(arr), cjson.LazyArray)
+        self.assertEqual(len(arr), 4)
+        self.assertEqual(arr[1], "two")
+        self.assertEqual(arr[-1]["four"], 4)
+        self.assertEqual(arr.materialize(), [1, "two", [3], {"four": 4}])
+        self.assertRaises(IndexError, lambda: arr[4])
+        self.assertEqual(cjson.decode_lazy("5"), 5)
+
+    def testDecodeLazyUnterminated(self):
+        self.assertRaises(cjson.DecodeError, cjson.decode_lazy, '{"a": [1, 2}')
+
+    def testGetPointer(self):
+        doc = '{"data": {"skip": [1, {"x": "]}"}], "items": [0, 1, 2, {"price": 9.5, "a/b": 1, "m~n": 2}]}}'
+        self.assertEqual(cjson.get(doc, "/data/items/3/price"), 9.5)
+        self.assertEqual(cjson.get(doc, "/data/items/3/a~1b"), 1)
+        self.assertEqual(cjson.get(doc, "/data/items/3/m~0n"), 2)
+        self.assertEqual(cjson.get(doc, "/data/skip/1/x"), "]}")
+        self.assertEqual(cjson.get(doc, ""), cjson.decode(doc))
+
+    def testGetMissingPointer(self):
+        self.assertEqual(cjson.get('{"items": [1, 2]}', "/items/2", None), None)
+        self.assertEqual(cjson.get('{"items": [1, 2]}', "/other", 5), 5)
+        self.assertRaises(KeyError, cjson.get, '{"items": [1, 2]}', "/items/2")
+
+    def testGetBadPointer(self):
+        self.assertRaises(ValueError, cjson.get, '{"items": [1, 2]}', "items")
+
+    def testReadSelectedFields(self):
+        doc = '{"id": 1, "junk": {"a": [1, {"b": "}"}]}, "user": {"name": "Pat", "age": 3}, "items": [{"sku": "x", "n": 1}, {"n": 2}]}'
+        obj = cjson.decode(doc, fields={"id", "user.name", "items[*].sku"})
+        self.assertEqual(obj, {"id": 1, "user": {"name": "Pat"}, "items": [{"sku": "x"}, {}]})
+        self.assertEqual(cjson.decode(doc, fields=["user", "user.name"]), {"user": {"name": "Pat", "age": 3}})
+        self.assertEqual(cjson.decode('[{"a": 1, "b": 2}, {"a": 3}]', fields=["[*].a"]), [{"a": 1}, {"a": 3}])
+        self.assertEqual(cjson.decode_lines('{"a": 1, "b": 2}\n{"a": 3, "c": [1]}\n', fields=["a"]), [{"a": 1}, {"a": 3}])
+
+    def testReadBadFieldPath(self):
+        self.assertRaises(ValueError, cjson.decode, '{"a": 1}', fields=["a..b"])
+
+    def testReadSkippedFieldError(self):
+        self.assertRaises(cjson.DecodeError, cjson.decode, '{"id": 1, "junk": [1, 2}', fields=["id"])
+        self.assertRaises(cjson.DecodeError, cjson.decode, '{"id": 1, "junk": tru@@e}', fields=["id"])
+        self.assertRaises(cjson.DecodeError, cjson.decode, '{"id": 1, "junk": 01}', fields=["id"])
+        self.assertRaises(cjson.DecodeError, cjson.decode, '{"id": 1, "junk": {"a": 1,}}', fields=["id"])
+
+    def testValidate(self):
+        self.assertEqual(cjson.validate(' [1, 2.5e3, "a\\u00e9", {"k": [true, false, null, NaN, -Infinity]}] '), (True, -1))
+        self.assertEqual(cjson.validate(bytearray('{"a": [1, 2]}')), (True, -1))
+        self.assertEqual(cjson.validate(u'"\xe9"'), (True, -1))
+
+    def testValidateErrorPosition(self):
+        self.assertEqual(cjson.validate(''), (False, 0))
+        self.assertEqual(cjson.validate('[1 2]'), (False, 3))
+        self.assertEqual(cjson.validate('{"a": 1,}'), (False, 8))
+        self.assertEqual(cjson.validate('{"a": [1, 2}'), (False, 11))
+        self.assertEqual(cjson.validate('[1] x'), (False, 4))
+        self.assertEqual(cjson.validate('[[[]]]', max_depth=2), (False, 2))
+        self.assertEqual(cjson.validate('  \n '), (False, 4))
+        valid, error_pos = cjson.validate('')
+        self.assertFalse(valid)
+
+    def testDecodeErrorLocation(self):
+        try:
+            cjson.decode('{"a": 1,\n "b": [1, 2}')
+        except cjson.DecodeError, e:
+            self.assertEqual(str(e), "expecting ',' or ']' at position 20")
+            self.assertEqual((e.pos, e.lineno, e.colno), (20, 2, 12))
+            self.assertEqual(e.excerpt, ' "b": [1, 2}')
+        else:
+            self.fail("DecodeError not raised")
+
+    def testDecodeErrorLocationOnLines(self):
+        try:
+            cjson.decode_lines('1\n2\n[x]\n')
+        except cjson.DecodeError, e:
+            self.assertEqual(str(e), "cannot parse JSON description on line 3")
+            self.assertEqual((e.pos, e.lineno, e.colno), (5, 3, 2))
+        else:
+            self.fail("DecodeError not raised")
+        e = cjson.DecodeError("error")
+        self.assertEqual((str(e), e.pos, e.lineno, e.excerpt), ("error", None, None, None))
+
+    def testIsValid(self):
+        self.assertEqual(cjson.is_valid('{"a": [1, 2.5, "x", null]}'), True)
+        self.assertEqual(cjson.is_valid('{"a": [1, 2}'), False)
+        self.assertEqual(cjson.is_valid('[[[]]]', max_depth=2), False)
+
+    def testRawDecode(self):
+        data = '{"a": 1}{"b": [2]} 3'
+        self.assertEqual(cjson.raw_decode(data), ({"a": 1}, 8))
+        self.assertEqual(cjson.raw_decode(data, 8), ({"b": [2]}, 18))
+        self.assertEqual(cjson.raw_decode(data, 18), (3, 20))
+        self.assertRaises(ValueError, cjson.raw_decode, data, 21)
+        self.assertRaises(TypeError, cjson.raw_decode, u'["\u20ac"] [2]')
+        self.assertEqual(cjson.raw_decode(bytearray(data), 8), ({"b": [2]}, 18))
+
+    def testDecodeAll(self):
+        self.assertEqual(list(cjson.decode_all('{"a": 1}{"b": [2]} 3 "x"[]\n')), [{"a": 1}, {"b": [2]}, 3, "x", []])
+        self.assertEqual(list(cjson.decode_all('  ')), [])
+        documents = cjson.decode_all('[1] [2 x')
+        self.assertEqual(documents.next(), [1])
+        self.assertRaises(cjson.DecodeError, documents.next)
+        self.assertEqual(list(documents), [])
+
+    def testDecodeLinesWorkers(self):
+        lines = ['{"id": %d, "tags": ["a", "b\\n"], "score": %d.5}' % (i, i) for i in range(20000)]
+        lines[123] = '{"id": [1, 2}'
+        lines[15000] = '[1,\n 2]'
+        data = '\n'.join(lines)
+        expected = cjson.decode_lines(data, errors='replace')
+        values = cjson.decode_lines(data, errors='replace', workers=4)
+        self.assertEqual(map(repr, values), map(repr, expected))
+        self.assertEqual(values[15000], [1, 2])
+        self.assertRaises(cjson.DecodeError, cjson.decode_lines, data, workers=4)
+        self.assertRaises(ValueError, cjson.decode_lines, data, workers=0)
+
+    def testOnlyJSONWhitespace(self):
+        self.assertEqual(cjson.decode(' \t\r\n[1,\r\n\t2] \n'), [1, 2])
+        self.assertRaises(cjson.DecodeError, cjson.decode, '\x0b[1]')
+        self.assertRaises(cjson.DecodeError, cjson.decode, '[1,\x0c2]')
+        self.assertEqual(cjson.is_valid('[1]\x0b'), False)
+
+    def testReuseScratchBuffers(self):
+        deep = '[' * 5000 + ']' * 5000
+        wide = '[' + ', '.join(['"a\\tb"'] * 5000) + ']'
+        for i in range(3):
+            self.assertEqual(len(cjson.decode(deep)), 1)
+            self.assertEqual(cjson.decode(wide), ["a\tb"] * 5000)
+            self.assertEqual(cjson.decode('{"a": [1, {"b": "c\\n"}]}'), {"a": [1, {"b": "c\n"}]})
+
+    def testDecodeColumns(self):
+        import array
+        columns = cjson.decode_columns('[{"id": 1, "x": 1.5, "name": "a"}, {"id": -2, "x": 2, "name": "b"}, {"id": 3, "x": 1e3}]')
+        self.assertEqual(sorted(columns.keys()), ['id', 'name', 'x'])
+        self.assertEqual(type(columns['id']), array.array)
+        self.assertEqual(columns['id'].typecode, 'l')
+        self.assertEqual(columns['id'].tolist(), [1, -2, 3])
+        self.assertEqual(columns['x'].typecode, 'd')
+        self.assertEqual(columns['x'].tolist(), [1.5, 2.0, 1000.0])
+        self.assertEqual(columns['name'], ['a', 'b', None])
+        self.assertEqual(cjson.decode_columns('[]'), {})
+        self.assertEqual(cjson.decode_columns('[{"a": 1, "a": [2]}]'), {'a': [[2]]})
+
+    def testDecodeColumnsErrors(self):
+        self.assertRaises(cjson.DecodeError, cjson.decode_columns, '{"a": 1}')
+        self.assertRaises(cjson.DecodeError, cjson.decode_columns, '[{"a": 1}, 2]')
+        self.assertRaises(cjson.DecodeError, cjson.decode_columns, '[{"a": 1}')
+        self.assertRaises(cjson.DecodeError, cjson.decode_columns, '[{"a": 1}] []')
+
+    def testDecodeNumericArrays(self):
+        import array
+        value = cjson.decode('{"ints": [1, -2, 3], "reals": [1, 2.5, 1e3], "mixed": [1, "a"], "empty": [], "big": [99999999999999999999]}', numeric_arrays=True)
+        self.assertEqual(type(value['ints']), array.array)
+        self.assertEqual(value['ints'].typecode, 'l')
+        self.assertEqual(value['ints'].tolist(), [1, -2, 3])
+        self.assertEqual(value['reals'].typecode, 'd')
+        self.assertEqual(value['reals'].tolist(), [1.0, 2.5, 1000.0])
+        self.assertEqual(value['mixed'], [1, 'a'])
+        self.assertEqual(value['empty'], [])
+        self.assertEqual(value['big'], [99999999999999999999L])
+        self.assertEqual(cjson.decode('[[1, 2], [9007199254740993, 0.5]]', numeric_arrays=True)[1], [9007199254740993, 0.5])
+        self.assertEqual(cjson.decode('{"a": [1.5]}', fields=['a'], numeric_arrays=True)['a'].typecode, 'd')
+        self.assertRaises(ValueError, cjson.decode, '[1]', numeric_arrays=True, use_decimal=True)
+
+    def testDecodeInto(self):
+        import array
+        buffer = array.array('d', [0.0] * 4)
+        self.assertEqual(cjson.decode_into('[1, 2.5, -3e2]', buffer), 3)
+        self.assertEqual(buffer.tolist(), [1.0, 2.5, -300.0, 0.0])
+        buffer = array.array('l', [0] * 2)
+        self.assertEqual(cjson.decode_into('[7, -8]', buffer), 2)
+        self.assertEqual(buffer.tolist(), [7, -8])
+        self.assertEqual(cjson.decode_into('[]', buffer), 0)
+        self.assertRaises(ValueError, cjson.decode_into, '[1, 2, 3]', buffer)
+        self.assertRaises(ValueError, cjson.decode_into, '[1.5]', buffer)
+        self.assertRaises(cjson.DecodeError, cjson.decode_into, '[[1]]', buffer)
+        self.assertRaises(cjson.DecodeError, cjson.decode_into, '[1', buffer)
+        self.assertRaises(TypeError, cjson.decode_into, '[1]', array.array('i', [0]))
+        buffer = array.array('l', [5, 5])
+        self.assertRaises(ValueError, cjson.decode_into, '[1, 1.5]', buffer)
+        self.assertEqual(buffer.tolist(), [5, 5])
+
+    def testDecodeIntoByteOrderFormats(self):
+        import ctypes
+        buffer = (ctypes.c_double * 3)()
+        self.assertEqual(memoryview(buffer).format[1:], 'd')
+        self.assertEqual(cjson.decode_into('[1, 2.5]', buffer), 2)
+        self.assertEqual(list(buffer), [1.0, 2.5, 0.0])
+        self.assertRaises(TypeError, cjson.decode_into, '[1]', (ctypes.c_int * 1)())
+
+    def testIteratorCyclesAreCollected(self):
+        import gc, weakref
+        class Hook(object):
+            def __call__(self, value):
+                return value
+        hook = Hook()
+        hook.iterator = cjson.decode_all('{} {}', object_hook=hook)
+        ref = weakref.ref(hook)
+        del hook
+        gc.collect()
+        self.assertEqual(ref(), None)
+
+    def testLazyRejectsBadScalars(self):
+        self.assertRaises(cjson.DecodeError, lambda: cjson.decode_lazy('{"a": 12abc}')['a'])
+        self.assertRaises(cjson.DecodeError, lambda: cjson.decode_lazy('[12abc, 3]')[0])
+        self.assertEqual(cjson.decode_lazy('[ 1 , true ]')[1], True)
+
+    def testLazyReprAndComparison(self):
+        value = cjson.decode_lazy('{"a": [1, {"b": 2}]}')
+        self.assertEqual(repr(value), "LazyObject({'a': [1, {'b': 2}]})")
+        self.assertEqual(repr(value['a']), "LazyArray([1, {'b': 2}])")
+        self.assertEqual(value, {'a': [1, {'b': 2}]})
+        self.assertEqual(value['a'], [1, {'b': 2}])
+        self.assertNotEqual(value['a'], [1])
+        self.assertEqual(value, cjson.decode_lazy('{"a": [1, {"b": 2}]}'))
+
+    def testDecodeScannerErrors(self):
+        large = '[' + ', '.join(['"%d"' % i for i in range(20000)]) + ']'
+        self.assertEqual(len(cjson.decode(large)), 20000)
+        for text, message in [(large[:-1], 'unterminated array starting at position 0'),
+                              ('[1, 2}', "expecting ',' or ']' at position 5"),
+                              ('{"a" 1}', 'missing colon after object property name at position 5'),
+                              ('[1] x', 'extra data after JSON description at position 4'),
+                              ('[truth]', 'cannot parse JSON description: truth]'),
+                              ('["\\x4", 1 2]', 'cannot decode string starting at position 1: truncated \\xXX escape')]:
+            try:
+                cjson.decode(text, all_unicode=True)
+            except cjson.DecodeError, e:
+                self.assertEqual(str(e), message)
+            else:
+                self.fail('no error decoding %r' % text)
+
+    def testWriteDecimalSubclass(self):
+        import decimal
+        class Amount(decimal.Decimal):
+            def __str__(self):
+                raise AssertionError('str() called')
+        self.assertEqual(cjson.encode([Amount("-12.50"), Amount("1e-9")]), "[-12.50, 1E-9]")
+        self.assertRaises(cjson.EncodeError, cjson.encode, object())
+
+    def testRawJSONValidationErrors(self):
+        for text, message in [('', 'empty JSON description'),
+                              ('[1] x', 'extra data after JSON description at position 4'),
+                              ('{"a": }', 'expecting object property value at position 6')]:
+            try:
+                cjson.RawJSON(text, validate=True)
+            except cjson.DecodeError, e:
+                self.assertEqual(str(e), message)
+            else:
+                self.fail('no error validating %r' % text)
+
+    def testDecodeErrorKeepsExcerpt(self):
+        text = '[' + '1, ' * 10000 + '\n  x]'
+        try:
+            cjson.decode(text)
+        except cjson.DecodeError, e:
+            self.assertEqual(e.msg, "cannot parse JSON description")
+            self.assertEqual((e.pos, e.lineno, e.colno), (30004, 2, 3))
+            self.assert_(len(e.doc) <= 40)
+            self.assertEqual(text[e.doc_pos:e.doc_pos+len(e.doc)], e.doc)
+            self.assertEqual(e.excerpt, "  x]")
+        else:
+            self.fail("no DecodeError raised")
+        try:
+            cjson.decode('{"a" 1}')
+        except cjson.DecodeError, e:
+            self.assertEqual(e.msg, "missing colon after object property name at position 5")
+            self.assertEqual(str(e), e.msg)
+
+    def testDecodeLinesWorkersCallHooksOnce(self):
+        data = '\n'.join(['{"id": %d}' % i for i in range(20000)])
+        calls = []
+        def hook(value):
+            calls.append(value)
+            if value["id"] == 500:
+                raise cjson.DecodeError("bad id")
+            return value
+        for workers in (1, 4):
+            del calls[:]
+            values = cjson.decode_lines(data, errors='replace', object_hook=hook, workers=workers)
+            self.assertEqual(len(calls), 20000)
+            self.assertEqual(str(values[500]), "bad id on line 501")
+
+    def testReadOldBufferClosedWhileDecoding(self):
+        import mmap
+        data = tempfile.TemporaryFile()
+        data.write('{"a": [' + ', '.join(['{"s": "item %d"}' % i for i in range(20000)]) + '], "b": "x"}')
+        data.flush()
+        mapping = mmap.mmap(data.fileno(), 0)
+        def hook(value):
+            mapping.close()
+            return value
+        value = cjson.decode(mapping, object_hook=hook)
+        self.assertEqual(value['a'][-1], {'s': 'item 19999'})
+        mapping = mmap.mmap(data.fileno(), 0)
+        lazy = cjson.decode_lazy(mapping)
+        mapping.close()
+        self.assertEqual(lazy['b'], 'x')
+        data.close()
+
+    def testDecodeFileErrorLocation(self):
+        fd, path = tempfile.mkstemp()
+        try:
+            os.write(fd, '[1,\n 2 x]')
+            os.close(fd)
+            try:
+                cjson.decode_file(path)
+            except cjson.DecodeError, e:
+                self.assertEqual((e.lineno, e.colno, e.excerpt), (2, 4, ' 2 x]'))
+            else:
+                self.fail("no DecodeError raised")
+        finally:
+            os.unlink(path)
+
+    def testDecodeErrorArgsAreTheMessage(self):
+        for data in ['{"a": [1, 2}', bytearray('{"a": [1, 2}'), u'{"a": [1, 2}']:
+            try:
+                cjson.decode(data)
+            except cjson.DecodeError, e:
+                self.assertEqual(e.args, ("expecting ',' or ']' at position 11",))
+                self.assertEqual(e.args[0], str(e))
+                self.assertEqual(e.message, str(e))
+                self.assertEqual((e.lineno, e.colno), (1, 12))
+            else:
+                self.fail("no DecodeError raised")
+        try:
+            cjson.decode_lines('[1]\n[2 x]\n')
+        except cjson.DecodeError, e:
+            self.assertEqual(e.args[0], str(e))
+            self.assertEqual((e.lineno, e.colno), (2, 4))
+
+    def testReadNumbersExactly(self):
+        numbers = ["0", "-0", "17", "-123456789012345678", "1234567890123456789012", "1.5", "-0.0",
+                   "0.1", "3.14159e-5", "1e22", "1e23", "2.2250738585072014e-308", "0.30000000000000004"]
+        values = cjson.decode("[" + ", ".join(numbers) + "]")
+        for number, value in zip(numbers, values):
+            if "." in number or "e" in number:
+                self.assertEqual(repr(value), repr(float(number)))
+            else:
+                self.assertEqual(value, int(number))
+
+    def testReadEscapedStrings(self):
+        self.assertEqual(cjson.decode(r'["a\"b\\c\b\f\n\r\t", "\/", "\x41\n"]'), ['a"b\\c\b\f\n\r\t', '\\/', 'A\n'])
+        self.assertEqual(cjson.decode(r'["a\nb", "\u00e9"]', all_unicode=True), [u'a\nb', u'\xe9'])
+
+    def testReadObjectHook(self):
+        obj = cjson.decode('{"a": {"b": [1, {}]}}', object_hook=len)
+        self.assertEqual(obj, 1)
+        objs = cjson.decode_lines('{"a": 1, "b": 2}\n{}\n', object_hook=sorted)
+        self.assertEqual(objs, [["a", "b"], []])
+
+    def testReadObjectPairsHook(self):
+        pairs = cjson.decode('{"b": 1, "a": {"x": [1, {}]}, "b": 2}', object_pairs_hook=list)
+        self.assertEqual(pairs, [("b", 1), ("a", [("x", [1, []])]), ("b", 2)])
+        self.assertEqual(cjson.decode('{"b": 1}', object_hook=dict, object_pairs_hook=tuple), (("b", 1),))
+
+    def testReadBadObjectHook(self):
+        self.assertRaises(TypeError, cjson.decode, '{}', object_hook=1)
+
+    def testReadArraysAsTuples(self):
+        obj = cjson.decode('[1, [2, []], {"a": [3]}]', array_type=tuple)
+        self.assertEqual(obj, (1, (2, ()), {"a": (3,)}))
+        self.assertEqual(cjson.decode_lines('[1]\n[]\n', array_type=tuple), [(1,), ()])
+
+    def testReadBadArrayType(self):
+        self.assertRaises(ValueError, cjson.decode, '[]', array_type=set)
+
+    def testReadDecimals(self):
+        obj = cjson.decode('[1.10, 2, 1e400, {"a": 3.3333333333333333333333}]', use_decimal=True)
+        self.assertEqual(obj, [decimal.Decimal("1.10"), 2, decimal.Decimal("1e400"), {"a": decimal.Decimal("3.3333333333333333333333")}])
+        self.assertEqual(type(obj[0]), decimal.Decimal)
+        self.assertEqual(type(obj[1]), int)
+
+    def testWriteDecimals(self):
+        for value in ["1.50", "-0", "100", "1E+2", "-1.5E-7", "0.000001", "1E-7", "12345678901234567890.5"]:
+            self.assertEqual(cjson.encode(decimal.Decimal(value)), str(decimal.Decimal(value)))
+        self.assertEqual(cjson.encode([decimal.Decimal("NaN"), decimal.Decimal("-Infinity")]), "[NaN, -Infinity]")
+
+    def testReadRawNumbers(self):
+        obj = cjson.decode('[1.50, -0, 1e5, 12345678901234567890123, {"a": 0.1000}]', raw_numbers=True)
+        self.assertEqual(obj[0], cjson.RawNumber("1.50"))
+        self.assertEqual(str(obj[2]), "1e5")
+        self.assertEqual(float(obj[0]), 1.5)
+        self.assertEqual(int(obj[3]), 12345678901234567890123)
+        self.assertEqual(cjson.encode(obj), '[1.50, -0, 1e5, 12345678901234567890123, {"a": 0.1000}]')
+
+    def testMakeBadRawNumber(self):
+        self.assertRaises(ValueError, cjson.RawNumber, "1.")
+
+    def testWriteRawJSON(self):
+        profile = cjson.RawJSON('{"name": "Pat", "tags": [1,2]}')
+        self.assertEqual(cjson.encode([profile, {"p": profile}]), '[{"name": "Pat", "tags": [1,2]}, {"p": {"name": "Pat", "tags": [1,2]}}]')
+        self.assertEqual(str(cjson.RawJSON(' 5 ', validate=True)), ' 5 ')
+
+    def testMakeBadRawJSON(self):
+        self.assertRaises(cjson.DecodeError, cjson.RawJSON, '{"a": }', validate=True)
+
     def testWriteLong(self):
         self.assertEqual("12345678901234567890", cjson.encode(12345678901234567890))
 